@@ -0,0 +1,106 @@
+"""
+Round-trip check of liblangid_arrow.so (langid_arrow.h) against pyarrow:
+export string columns through the Arrow C Data Interface, identify them,
+import the results, and compare with identify() row by row.
+
+Needs pyarrow and cffi (pip install pyarrow cffi), for this script only.
+
+  make liblangid_arrow.so
+  python arrowtest.py [corpus] [./liblangid_arrow.so]
+"""
+
+import ctypes
+import sys
+import time
+
+import pyarrow as pa
+from pyarrow.cffi import ffi
+
+
+def addr(x):
+  return int(ffi.cast('uintptr_t', x))
+
+
+class Lib(object):
+  def __init__(self, path):
+    lib = ctypes.CDLL(path)
+    lib.get_default_identifier.restype = ctypes.c_void_p
+    lib.identify.restype = ctypes.c_char_p
+    lib.identify.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint]
+    lib.create_pool.restype = ctypes.c_void_p
+    lib.create_pool.argtypes = [ctypes.c_void_p, ctypes.c_uint]
+    lib.destroy_pool.argtypes = [ctypes.c_void_p]
+    lib.langid_arrow_identify.argtypes = [ctypes.c_void_p] * 8
+    self.lib = lib
+    self.lid = lib.get_default_identifier()
+
+  def identify(self, arr, scores=True, pool=None):
+    """
+    Return (langs, scores or None, seconds) for a pyarrow array.
+    """
+    schema, array = ffi.new('struct ArrowSchema*'), ffi.new('struct ArrowArray*')
+    arr._export_to_c(addr(array), addr(schema))
+    ls, la = ffi.new('struct ArrowSchema*'), ffi.new('struct ArrowArray*')
+    ss, sa = ffi.new('struct ArrowSchema*'), ffi.new('struct ArrowArray*')
+    t = time.perf_counter()
+    rc = self.lib.langid_arrow_identify(self.lid, pool, addr(schema), addr(array), addr(ls), addr(la),
+                                        addr(ss) if scores else None, addr(sa) if scores else None)
+    t = time.perf_counter() - t
+    array.release(array)
+    schema.release(schema)
+    if rc:
+      raise ValueError("langid_arrow_identify: {0}".format(rc))
+    langs = pa.Array._import_from_c(addr(la), addr(ls))
+    return langs, pa.Array._import_from_c(addr(sa), addr(ss)) if scores else None, t
+
+  def reference(self, values):
+    return [None if v is None else self.lib.identify(self.lid, v, len(v)).decode() for v in values]
+
+
+def main(corpus='corpus.txt', path='./liblangid_arrow.so'):
+  lib = Lib(path)
+  failed = 0
+
+  def check(what, got, want):
+    nonlocal failed
+    differ = sum(a != b for a, b in zip(got, want)) + abs(len(got) - len(want))
+    print("{0}: {1} rows, {2} differ".format(what, len(want), differ))
+    failed += differ != 0
+
+  with open(corpus, 'rb') as f:
+    lines = [l.rstrip(b'\n').decode('utf-8', 'replace') for l in f]
+  arr = pa.array(lines)
+  want = lib.reference(s.encode() for s in lines)
+
+  langs, scores, t = lib.identify(arr)
+  check("string + scores ({0:.3f} s)".format(t), langs.to_pylist(), want)
+  failed += not all(0 <= s <= 1 for s in scores.to_pylist())
+  langs, _, t = lib.identify(arr, scores=False)
+  check("string ({0:.3f} s)".format(t), langs.to_pylist(), want)
+  pool = lib.lib.create_pool(lib.lid, 2)
+  langs, _, t = lib.identify(arr, scores=False, pool=pool)
+  check("string, 2-thread pool ({0:.3f} s)".format(t), langs.to_pylist(), want)
+  lib.lib.destroy_pool(pool)
+
+  # nulls, offsets and the other input types
+  a = pa.array(['hello world this is english', None, 'der Hund ist sehr gut und schnell',
+                'le chien est très bon', None, 'el perro es muy bueno'])
+  for b in [a, a.slice(1), a.slice(3), a.cast(pa.large_string()).slice(1), a.cast(pa.binary()),
+            a.cast(pa.large_binary()).slice(2)]:
+    langs, scores, _ = lib.identify(b)
+    values = [None if v is None else v if isinstance(v, bytes) else v.encode() for v in b.to_pylist()]
+    check(str(b.type), langs.to_pylist(), lib.reference(values))
+    failed += [s is None for s in scores.to_pylist()] != [v is None for v in values]
+
+  try:
+    lib.identify(pa.array([1, 2]))
+    print("int64 input accepted")
+    failed += 1
+  except ValueError:
+    pass
+
+  return 1 if failed else 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(*sys.argv[1:]))
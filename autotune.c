@@ -0,0 +1,313 @@
+/*
+ * langid autotune: pick the fastest engine settings for this host
+ *
+ * The reference is the built-in default (SCAN_MASK, WEIGHTS_DOUBLE). Every
+ * scan/weights combination labels the whole sample; one that disagrees with
+ * the reference on any document is reported and never chosen. The fastest
+ * remaining combination is then run with 1..T threads, each with its own
+ * clone_identifier, to choose the default worker count. Before that, the
+ * sample is cut into texts of increasing sizes to find how long a text can
+ * be while short_text_logprobs is still faster than the general path.
+ */
+
+#include "autotune.h"
+#include "config.h"
+#include "liblangid.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_SECONDS 0.25
+/* text cut into pieces for each short size */
+#define SHORT_TUNE_BYTES (1 << 18)
+
+/* short sizes to try, increasing */
+static unsigned const short_sizes[] = {8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256};
+
+typedef struct {
+  char** docs;
+  unsigned* lens;
+  size_t n, bytes;
+} Sample;
+
+static void usage_autotune(void) {
+  printf("Usage: langid autotune [-m model] [-o config] [-n docs] [-T threads] [sample...]\n"
+         "\n Times each engine variant and thread count on the sample (lines of"
+         "\n the files, or of stdin) and writes the fastest settings whose labels"
+         "\n match the reference engine to -o (default $LANGID_CONFIG, or"
+         "\n ~/.langid.conf), which langid reads at startup."
+         "\n -n: use at most this many sample lines (default 10000)"
+         "\n -T: most threads to try (default: online CPUs)\n");
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_sample(FILE* f, Sample* s, size_t max) {
+  char* line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  while (s->n < max && (len = getline(&line, &size, f)) > 0) {
+    if (line[len - 1] == '\n') --len;
+    if ((s->docs = (char**)realloc(s->docs, (s->n + 1) * sizeof(char*))) == 0) exit(-1);
+    if ((s->lens = (unsigned*)realloc(s->lens, (s->n + 1) * sizeof(unsigned))) == 0) exit(-1);
+    if ((s->docs[s->n] = (char*)malloc(len + 1)) == 0) exit(-1);
+    memcpy(s->docs[s->n], line, len);
+    s->lens[s->n++] = len;
+    s->bytes += len;
+  }
+  free(line);
+}
+
+static void label_sample(LanguageIdentifier* lid, Sample const* s, LangIndex* labels) {
+  size_t i;
+  for (i = 0; i < s->n; i++)
+    labels[i] = identify_index(lid, s->docs[i], s->lens[i]);
+}
+
+/* passes over the sample in seconds; the best of 3 */
+static double time_sample(LanguageIdentifier* lid, Sample const* s, unsigned passes) {
+  double best = 1e30, t;
+  unsigned rep, p;
+  size_t i;
+  for (rep = 0; rep < 3; rep++) {
+    t = now();
+    for (p = 0; p < passes; p++)
+      for (i = 0; i < s->n; i++)
+        identify_index(lid, s->docs[i], s->lens[i]);
+    if ((t = now() - t) < best) best = t;
+  }
+  return best;
+}
+
+static void general_logprobs(LanguageIdentifier* lid, char const* text, unsigned len, double* logprobs) {
+  text_to_fv(lid, text, len, lid->sv, lid->fv);
+  fv_to_logprob(lid, lid->fv, logprobs);
+}
+
+typedef void Path(LanguageIdentifier*, char const*, unsigned, double*);
+
+/* seconds to score text[0..len) in pieces of size bytes */
+static double time_pieces(LanguageIdentifier* lid, Path* path, char const* text, size_t len, unsigned size) {
+  double logprobs[lid->num_langs], t = now();
+  size_t off;
+  for (off = 0; off + size <= len; off += size) path(lid, text + off, size, logprobs);
+  return now() - t;
+}
+
+/* the largest short size up to which short_text_logprobs is faster (and
+ * agrees) at every size tried; 0 if it isn't even at the smallest */
+static unsigned tune_short(LanguageIdentifier* lid, Sample const* s) {
+  char* text;
+  double a[lid->num_langs], b[lid->num_langs], general, fast;
+  size_t len = 0, i, off, differ;
+  unsigned k, size, rep, best = 0;
+
+  if ((text = (char*)malloc(SHORT_TUNE_BYTES)) == 0) exit(-1);
+  for (i = 0; i < s->n && len < SHORT_TUNE_BYTES; i++) {
+    size = s->lens[i] < SHORT_TUNE_BYTES - len ? s->lens[i] : SHORT_TUNE_BYTES - len;
+    memcpy(text + len, s->docs[i], size);
+    len += size;
+  }
+  for (k = 0; k < sizeof short_sizes / sizeof *short_sizes && (size = short_sizes[k]) <= len; k++) {
+    for (differ = off = 0; off + size <= len; off += size) {
+      general_logprobs(lid, text + off, size, a);
+      short_text_logprobs(lid, text + off, size, b);
+      differ += logprob_to_pred(lid, a) != logprob_to_pred(lid, b);
+    }
+    /* the best of 5, alternating, as the difference is often small */
+    for (general = fast = 1e30, rep = 0; rep < 5; rep++) {
+      general = fmin(general, time_pieces(lid, general_logprobs, text, len, size));
+      fast = fmin(fast, time_pieces(lid, short_text_logprobs, text, len, size));
+    }
+    printf("short %3u %8.2f MB/s, general %8.2f MB/s", size, len / fast / 1e6, len / general / 1e6);
+    if (differ) {
+      printf("  rejected: %zu labels differ\n", differ);
+      break;
+    }
+    printf("\n");
+    if (fast >= general) break;
+    best = size;
+  }
+  free(text);
+  return best;
+}
+
+typedef struct {
+  LanguageIdentifier* lid;
+  Sample const* sample;
+  unsigned passes;
+  pthread_t thread;
+} Runner;
+
+static void* run_passes(void* arg) {
+  Runner* r = (Runner*)arg;
+  unsigned p;
+  size_t i;
+  for (p = 0; p < r->passes; p++)
+    for (i = 0; i < r->sample->n; i++)
+      identify_index(r->lid, r->sample->docs[i], r->sample->lens[i]);
+  return NULL;
+}
+
+/* wall time for each of nthreads clones to make passes over the sample */
+static double time_threads(LanguageIdentifier* lid, Sample const* s, unsigned passes, unsigned nthreads) {
+  Runner* runners;
+  double t;
+  unsigned i;
+  if ((runners = (Runner*)malloc(nthreads * sizeof(Runner))) == 0) exit(-1);
+  for (i = 0; i < nthreads; i++) {
+    runners[i].lid = clone_identifier(lid);
+    runners[i].sample = s;
+    runners[i].passes = passes;
+  }
+  t = now();
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(&runners[i].thread, NULL, run_passes, &runners[i])) {
+      fprintf(stderr, "autotune: unable to start thread %u\n", i);
+      exit(-1);
+    }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(runners[i].thread, NULL);
+  t = now() - t;
+  for (i = 0; i < nthreads; i++)
+    destroy_identifier(runners[i].lid);
+  free(runners);
+  return t;
+}
+
+int autotune_main(int argc, char** argv) {
+  char* model_path = NULL;
+  char const* out_path = config_path();
+  size_t max_docs = 10000, i, differ;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned max_threads = ncpu > 0 ? ncpu : 1, passes, t;
+  Sample sample = {NULL, NULL, 0, 0};
+  LanguageIdentifier* lid;
+  LangIndex *reference, *labels;
+  LangidConfig cfg, best;
+  double secs, rate, best_rate = 0;
+  char host[256], comment[512];
+  int c;
+  FILE* f;
+
+  optind = 1;
+  while ((c = getopt(argc, argv, "hm:o:n:T:")) != -1)
+    switch (c) {
+    case 'm':
+      model_path = optarg;
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'n':
+      max_docs = strtoul(optarg, NULL, 10);
+      break;
+    case 'T':
+      if ((max_threads = atoi(optarg)) < 1) max_threads = 1;
+      break;
+    case 'h':
+      usage_autotune();
+      return 0;
+    default:
+      usage_autotune();
+      return 1;
+    }
+
+  if (optind == argc)
+    read_sample(stdin, &sample, max_docs);
+  for (; optind < argc; optind++) {
+    if ((f = fopen(argv[optind], "r")) == NULL) {
+      fprintf(stderr, "unable to open: %s\n", argv[optind]);
+      exit(-1);
+    }
+    read_sample(f, &sample, max_docs);
+    fclose(f);
+  }
+  if (!sample.bytes) {
+    fprintf(stderr, "autotune: the sample is empty\n");
+    exit(-1);
+  }
+
+  lid = model_path ? load_identifier(model_path) : get_default_identifier();
+  if ((reference = (LangIndex*)malloc(sample.n * sizeof(LangIndex))) == 0) exit(-1);
+  if ((labels = (LangIndex*)malloc(sample.n * sizeof(LangIndex))) == 0) exit(-1);
+
+  default_config(&cfg);
+  set_engine(lid, &cfg);
+  label_sample(lid, &sample, reference);
+  /* enough passes that one takes MIN_SECONDS */
+  secs = time_sample(lid, &sample, 1);
+  passes = secs >= MIN_SECONDS ? 1 : (unsigned)(MIN_SECONDS / (secs + 1e-9)) + 1;
+  printf("sample: %zu documents, %zu bytes; %u passes per timing\n", sample.n, sample.bytes, passes);
+
+  best = cfg;
+  for (cfg.scan = SCAN_MASK; cfg.scan <= SCAN_HASH; cfg.scan++)
+    for (cfg.weights = WEIGHTS_DOUBLE; cfg.weights <= WEIGHTS_FLOAT; cfg.weights++) {
+      set_engine(lid, &cfg);
+      if (lid->scan != cfg.scan) {
+        printf("scan %-6s unavailable for this model\n", scan_name(cfg.scan));
+        break;
+      }
+      label_sample(lid, &sample, labels);
+      for (differ = i = 0; i < sample.n; i++)
+        differ += labels[i] != reference[i];
+      secs = time_sample(lid, &sample, passes);
+      rate = passes * sample.bytes / secs;
+      printf("scan %-6s weights %-6s %8.2f MB/s", scan_name(cfg.scan), weights_name(cfg.weights), rate / 1e6);
+      if (differ) {
+        printf("  rejected: %zu labels differ\n", differ);
+        continue;
+      }
+      printf("\n");
+      if (rate > best_rate) {
+        best_rate = rate;
+        best.scan = cfg.scan;
+        best.weights = cfg.weights;
+      }
+    }
+
+  set_engine(lid, &best);
+  best.short_max = tune_short(lid, &sample);
+  set_engine(lid, &best);
+
+  /* more threads only count if they add 5%, as they cost memory and
+   * contend with everything else on the host */
+  best.threads = 1;
+  best_rate = passes * sample.bytes / time_sample(lid, &sample, passes);
+  printf("threads %2u %8.2f MB/s\n", 1, best_rate / 1e6);
+  for (t = 2; t <= max_threads; t++) {
+    rate = t * (passes * sample.bytes / time_threads(lid, &sample, passes, t));
+    printf("threads %2u %8.2f MB/s\n", t, rate / 1e6);
+    if (rate > 1.05 * best_rate) {
+      best_rate = rate;
+      best.threads = t;
+    }
+  }
+
+  if (gethostname(host, sizeof host)) strcpy(host, "?");
+  host[sizeof host - 1] = 0;
+  snprintf(comment, sizeof comment, "langid autotune on %s: %zu documents, %zu bytes", host, sample.n, sample.bytes);
+  if (!write_config(out_path, &best, comment)) {
+    fprintf(stderr, "unable to write: %s\n", out_path);
+    exit(-1);
+  }
+  printf("wrote %s: scan %s, weights %s, threads %u, short %u\n", out_path, scan_name(best.scan),
+         weights_name(best.weights), best.threads, best.short_max);
+
+  destroy_identifier(lid);
+  for (i = 0; i < sample.n; i++)
+    free(sample.docs[i]);
+  free(sample.docs);
+  free(sample.lens);
+  free(reference);
+  free(labels);
+  return 0;
+}
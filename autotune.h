@@ -0,0 +1,10 @@
+#ifndef _AUTOTUNE_H
+#define _AUTOTUNE_H
+
+/* `langid autotune [options] [sample...]`: time each engine variant and
+ * thread count on a sample of the user's documents and write the fastest
+ * whose labels all match the reference engine's to the config file (see
+ * config.h). argv[0] is "autotune". */
+extern int autotune_main(int argc, char** argv);
+
+#endif
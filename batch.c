@@ -0,0 +1,261 @@
+/*
+ * Parallel batch identification; see batch.h
+ *
+ * Each thread has a deque of document indices, filled before the batch
+ * starts and never pushed to afterwards, so it is just a [top, bottom)
+ * range packed in one 64-bit word: the owner takes from the top (its
+ * largest documents) and thieves from the bottom, each with a single
+ * compare-and-swap.
+ */
+
+#include "batch.h"
+#include "probes.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  uint64_t range __attribute__((aligned(64))); /* bottom << 32 | top */
+} Deque;
+
+typedef struct {
+  LangidPool* pool;
+  LanguageIdentifier* lid;
+  unsigned id;
+  pthread_t thread;
+} PoolWorker;
+
+struct LangidPool {
+  unsigned threads;
+  PoolWorker* workers;
+  Deque* deques;
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  unsigned generation, busy;
+  int quit;
+
+  /* the current batch */
+  char const* const* docs;
+  unsigned const* lens;
+  LangIndex* results;
+  unsigned* order; /* deques index into this */
+  size_t order_size;
+};
+
+#define TOP(r) ((uint32_t)(r))
+#define BOTTOM(r) ((uint32_t)((r) >> 32))
+
+/* the next document from the top of d, or -1 */
+static int64_t take(Deque* d) {
+  uint64_t r = __atomic_load_n(&d->range, __ATOMIC_ACQUIRE);
+  do
+    if (TOP(r) >= BOTTOM(r)) return -1;
+  while (!__atomic_compare_exchange_n(&d->range, &r, r + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return TOP(r);
+}
+
+static int64_t steal(Deque* d) {
+  uint64_t r = __atomic_load_n(&d->range, __ATOMIC_ACQUIRE);
+  do
+    if (TOP(r) >= BOTTOM(r)) return -1;
+  while (!__atomic_compare_exchange_n(&d->range, &r, r - ((uint64_t)1 << 32), 1, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_ACQUIRE));
+  return BOTTOM(r) - 1;
+}
+
+static void run_batch(PoolWorker* w) {
+  LangidPool* p = w->pool;
+  unsigned i, victim;
+  int64_t k;
+  size_t doc;
+
+  for (;;) {
+    if ((k = take(&p->deques[w->id])) < 0) {
+      /* steal from the others in turn, starting after this one */
+      for (i = 1; i < p->threads; i++) {
+        victim = (w->id + i) % p->threads;
+        if ((k = steal(&p->deques[victim])) >= 0) {
+          LANGID_PROBE(batch__steal, w->id, victim);
+          break;
+        }
+      }
+      if (k < 0) return;
+    }
+    doc = p->order[k];
+    p->results[doc] = identify_index(w->lid, p->docs[doc], p->lens[doc]);
+  }
+}
+
+static void* pool_thread(void* arg) {
+  PoolWorker* w = (PoolWorker*)arg;
+  LangidPool* p = w->pool;
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->generation == seen && !p->quit) pthread_cond_wait(&p->start, &p->lock);
+    if (p->quit) break;
+    seen = p->generation;
+    pthread_mutex_unlock(&p->lock);
+    run_batch(w);
+    pthread_mutex_lock(&p->lock);
+    if (!--p->busy) pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+LangidPool* create_pool(LanguageIdentifier* lid, unsigned threads) {
+  LangidPool* p;
+  unsigned i;
+
+  if (!threads) threads = host_config()->threads;
+  if (!threads) threads = 1;
+  if ((p = (LangidPool*)malloc(sizeof(LangidPool))) == 0) exit(-1);
+  if ((p->workers = (PoolWorker*)malloc(threads * sizeof(PoolWorker))) == 0) exit(-1);
+  if ((p->deques = (Deque*)aligned_alloc(sizeof(Deque), threads * sizeof(Deque))) == 0) exit(-1);
+  p->threads = threads;
+  p->generation = p->busy = 0;
+  p->quit = 0;
+  p->order = NULL;
+  p->order_size = 0;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->done, NULL);
+
+  for (i = 0; i < threads; i++) {
+    p->workers[i].pool = p;
+    p->workers[i].lid = clone_identifier(lid);
+    p->workers[i].id = i;
+  }
+  /* worker 0 is whichever thread calls pool_identify */
+  for (i = 1; i < threads; i++)
+    if (pthread_create(&p->workers[i].thread, NULL, pool_thread, &p->workers[i])) {
+      fprintf(stderr, "unable to start batch thread %u\n", i);
+      exit(-1);
+    }
+  return p;
+}
+
+void destroy_pool(LangidPool* p) {
+  unsigned i;
+
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 1; i < p->threads; i++)
+    pthread_join(p->workers[i].thread, NULL);
+  for (i = 0; i < p->threads; i++)
+    destroy_identifier(p->workers[i].lid);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->start);
+  pthread_cond_destroy(&p->done);
+  free(p->order);
+  free(p->deques);
+  free(p->workers);
+  free(p);
+}
+
+unsigned pool_threads(LangidPool const* p) {
+  return p->threads;
+}
+
+static unsigned log2_size(unsigned len) {
+  return len ? 32 - __builtin_clz(len) : 0;
+}
+
+/*
+ * Fill the deques. Documents are ordered by size class (bit length of
+ * their size), largest first, which is all the ordering that scheduling
+ * needs and takes two passes rather than a sort. Each goes to the thread
+ * with the fewest bytes so far, and each deque's documents are contiguous
+ * in order[], so first they are counted per thread and then placed.
+ */
+static void deal(LangidPool* p, unsigned const* lens, size_t n) {
+  size_t start[34] = {0}, i, k;
+  uint64_t* load;
+  unsigned* owner;
+  unsigned* by_size;
+  unsigned t, c, least, *count, *next;
+
+  if (p->order_size < n) {
+    free(p->order);
+    if ((p->order = (unsigned*)malloc(n * sizeof(unsigned))) == 0) exit(-1);
+    p->order_size = n;
+  }
+  if ((by_size = (unsigned*)malloc(n * sizeof(unsigned))) == 0) exit(-1);
+  if ((owner = (unsigned*)malloc(n * sizeof(unsigned))) == 0) exit(-1);
+  if ((load = (uint64_t*)calloc(p->threads, sizeof(uint64_t))) == 0) exit(-1);
+  if ((count = (unsigned*)calloc(2 * p->threads, sizeof(unsigned))) == 0) exit(-1);
+  next = count + p->threads;
+
+  /* counting sort by size class, descending */
+  for (i = 0; i < n; i++)
+    start[33 - log2_size(lens[i])]++;
+  for (c = 0, k = 0; c < 34; c++) {
+    size_t m = start[c];
+    start[c] = k;
+    k += m;
+  }
+  for (i = 0; i < n; i++)
+    by_size[start[33 - log2_size(lens[i])]++] = i;
+
+  for (k = 0; k < n; k++) {
+    for (least = 0, t = 1; t < p->threads; t++)
+      if (load[t] < load[least]) least = t;
+    load[least] += lens[by_size[k]] + 1;
+    owner[k] = least;
+    count[least]++;
+  }
+  for (t = 0, k = 0; t < p->threads; t++) {
+    next[t] = k;
+    p->deques[t].range = (uint64_t)(k + count[t]) << 32 | k;
+    k += count[t];
+  }
+  for (k = 0; k < n; k++)
+    p->order[next[owner[k]]++] = by_size[k];
+
+  free(by_size);
+  free(owner);
+  free(load);
+  free(count);
+}
+
+void pool_identify(LangidPool* p, char const* const* docs, unsigned const* lens, size_t n, LangIndex* results) {
+  size_t i;
+
+  if (!n) return;
+  LANGID_PROBE(batch__start, p, n, p->threads);
+  if (p->threads == 1) {
+    for (i = 0; i < n; i++)
+      results[i] = identify_index(p->workers[0].lid, docs[i], lens[i]);
+    LANGID_PROBE(batch__done, p, n);
+    return;
+  }
+  p->docs = docs;
+  p->lens = lens;
+  p->results = results;
+  deal(p, lens, n);
+
+  pthread_mutex_lock(&p->lock);
+  p->busy = p->threads - 1;
+  p->generation++;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  run_batch(&p->workers[0]);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->busy) pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  LANGID_PROBE(batch__done, p, n);
+}
+
+void identify_batch(LanguageIdentifier* lid, char const* const* docs, unsigned const* lens, size_t n,
+                    LangIndex* results, unsigned threads) {
+  LangidPool* p = create_pool(lid, threads);
+  pool_identify(p, docs, lens, n, results);
+  destroy_pool(p);
+}
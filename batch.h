@@ -0,0 +1,31 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "liblangid.h"
+#include <stddef.h>
+
+/* Parallel batch identification: results[i] = identify_index(docs[i],
+ * lens[i]) for a batch of documents, spread over threads that each score
+ * with their own clone_identifier. Documents are dealt out largest first,
+ * balancing total bytes per thread; a thread that runs out steals the
+ * smallest remaining documents from the others.
+ *
+ * A pool keeps its threads (waiting between batches), so a service can make
+ * one and reuse it for every batch. The calling thread works on the batch
+ * too, so a pool of N threads starts N - 1. Batches hold under 2^32
+ * documents; one pool runs one batch at a time.
+ */
+
+typedef struct LangidPool LangidPool;
+
+/** threads 0: the autotune config's threads. destroy before lid */
+extern LangidPool* create_pool(LanguageIdentifier* lid, unsigned threads);
+extern void destroy_pool(LangidPool*);
+extern unsigned pool_threads(LangidPool const*);
+extern void pool_identify(LangidPool*, char const* const* docs, unsigned const* lens, size_t n, LangIndex* results);
+
+/** one batch on a pool made just for it */
+extern void identify_batch(LanguageIdentifier* lid, char const* const* docs, unsigned const* lens, size_t n,
+                           LangIndex* results, unsigned threads);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Per-host engine settings (see config.h)
+ */
+
+#include "config.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const* const scan_names[] = {"mask", "branch", "hash"};
+static char const* const weights_names[] = {"double", "float"};
+
+char const* scan_name(int scan) {
+  return scan_names[scan];
+}
+
+char const* weights_name(int weights) {
+  return weights_names[weights];
+}
+
+void default_config(LangidConfig* cfg) {
+  cfg->scan = SCAN_MASK;
+  cfg->weights = WEIGHTS_DOUBLE;
+  cfg->threads = 1;
+  cfg->short_max = SHORT_TEXT_CUTOFF;
+}
+
+char const* config_path(void) {
+  static char path[4096];
+  char const* env = getenv("LANGID_CONFIG");
+  if (env) return env;
+  snprintf(path, sizeof path, "%s/.langid.conf", (env = getenv("HOME")) ? env : ".");
+  return path;
+}
+
+static int lookup(char const* const* names, int n, char const* value) {
+  int i;
+  for (i = 0; i < n; ++i)
+    if (!strcmp(names[i], value)) return i;
+  return -1;
+}
+
+int read_config(char const* path, LangidConfig* cfg) {
+  FILE* f;
+  char line[256], key[64], value[64];
+  unsigned lineno = 0;
+  int v;
+
+  if ((f = fopen(path, "r")) == NULL) return 0;
+  while (fgets(line, sizeof line, f)) {
+    ++lineno;
+    line[strcspn(line, "#")] = 0;
+    if (sscanf(line, "%63s %63s", key, value) != 2) continue;
+    if (!strcmp(key, "scan") && (v = lookup(scan_names, 3, value)) >= 0)
+      cfg->scan = v;
+    else if (!strcmp(key, "weights") && (v = lookup(weights_names, 2, value)) >= 0)
+      cfg->weights = v;
+    else if (!strcmp(key, "threads") && (v = atoi(value)) > 0)
+      cfg->threads = v;
+    else if (!strcmp(key, "short") && isdigit((unsigned char)*value))
+      cfg->short_max = atoi(value);
+    else
+      fprintf(stderr, "%s:%u: ignoring '%s %s'\n", path, lineno, key, value);
+  }
+  fclose(f);
+  return 1;
+}
+
+int write_config(char const* path, LangidConfig const* cfg, char const* comment) {
+  FILE* f;
+  if ((f = fopen(path, "w")) == NULL) return 0;
+  if (comment) fprintf(f, "# %s\n", comment);
+  fprintf(f, "scan %s\nweights %s\nthreads %u\nshort %u\n", scan_name(cfg->scan), weights_name(cfg->weights),
+          cfg->threads, cfg->short_max);
+  return fclose(f) == 0;
+}
+
+static LangidConfig host;
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+
+static void read_host_config(void) {
+  default_config(&host);
+  read_config(config_path(), &host);
+}
+
+LangidConfig const* host_config(void) {
+  pthread_once(&host_once, read_host_config);
+  return &host;
+}
@@ -0,0 +1,48 @@
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+/* Per-host engine settings, written by `langid autotune` and applied by
+ * get_default_identifier, load_identifier and the CLI. The file is lines of
+ * "key value" ('#' starts a comment):
+ *
+ *   scan mask|branch|hash  how the tokenizer skips states that emit no
+ *                        features, or hash: n-gram lookups (hashfv.h)
+ *   weights double|float precision of the naive Bayes weights while scoring
+ *   threads N            default worker threads (langid -w)
+ *   short N              texts of up to N bytes are scored by
+ *                        short_text_logprobs (0: none)
+ *
+ * It is $LANGID_CONFIG if set, otherwise ~/.langid.conf.
+ */
+
+enum { SCAN_MASK, SCAN_BRANCH, SCAN_HASH };
+enum { WEIGHTS_DOUBLE, WEIGHTS_FLOAT };
+
+/* the default short: where the short path stops being faster in the -Os
+ * build (see shortbench); autotune measures it for the host */
+#ifndef SHORT_TEXT_CUTOFF
+#define SHORT_TEXT_CUTOFF 16
+#endif
+
+typedef struct {
+  int scan, weights;
+  unsigned threads;
+  unsigned short_max;
+} LangidConfig;
+
+/** the built-in defaults: mask, double, 1 thread, short SHORT_TEXT_CUTOFF */
+extern void default_config(LangidConfig*);
+/** the config file's path (static storage) */
+extern char const* config_path(void);
+/** read path over *cfg; 0 if it can't be opened. bad lines are reported and
+    skipped */
+extern int read_config(char const* path, LangidConfig* cfg);
+/** 0 on failure */
+extern int write_config(char const* path, LangidConfig const* cfg, char const* comment);
+/** this host's settings, read from config_path() on first use */
+extern LangidConfig const* host_config(void);
+
+extern char const* scan_name(int scan);
+extern char const* weights_name(int weights);
+
+#endif
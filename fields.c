@@ -0,0 +1,158 @@
+/*
+ * In-place field extraction for TSV and JSONL line records, so that
+ * line-mode can identify a single field without a cut/jq pass in front.
+ */
+
+#include "fields.h"
+#include "liblangid.h"
+#include "transcode.h"
+#include <string.h>
+
+char const* tsv_field(char const* rec, size_t len, unsigned col, size_t* fieldlen) {
+  char const *end = rec + len, *tab;
+  if (len && end[-1] == '\n') --end;
+  for (; col; --col) {
+    if (!(tab = memchr(rec, '\t', end - rec))) return NULL;
+    rec = tab + 1;
+  }
+  tab = memchr(rec, '\t', end - rec);
+  *fieldlen = (tab ? tab : end) - rec;
+  return rec;
+}
+
+static char const* skip_ws(char const* p, char const* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+  return p;
+}
+
+/* p is just past an opening quote; return the closing quote (or end) */
+static char const* string_end(char const* p, char const* end) {
+  for (; p < end; ++p)
+    if (*p == '\\')
+      ++p;
+    else if (*p == '"')
+      return p;
+  return end;
+}
+
+/* skip one JSON value starting at p (which is not whitespace) */
+static char const* skip_value(char const* p, char const* end) {
+  unsigned depth = 0;
+  for (; p < end; ++p) {
+    char c = *p;
+    if (c == '"') {
+      p = string_end(p + 1, end);
+      if (!depth) return p + 1;
+    } else if (c == '{' || c == '[')
+      ++depth;
+    else if (c == '}' || c == ']') {
+      if (!depth) return p;
+      if (!--depth) return p + 1;
+    } else if (!depth && (c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r'))
+      return p;
+  }
+  return end;
+}
+
+char const* json_object(char const* rec, size_t len, size_t* objectlen) {
+  char const *p = skip_ws(rec, rec + len), *end = rec + len;
+  while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) --end;
+  if (end - p < 2 || *p != '{' || end[-1] != '}') return NULL;
+  *objectlen = end - p;
+  return p;
+}
+
+char const* json_value(char const* rec, size_t len, char const* key, size_t* valuelen) {
+  char const *p = rec, *end = rec + len, *k, *v;
+  size_t keylen = strlen(key);
+  p = skip_ws(p, end);
+  if (p == end || *p++ != '{') return NULL;
+  for (;;) {
+    p = skip_ws(p, end);
+    if (p == end || *p != '"') return NULL;
+    k = ++p;
+    p = string_end(p, end);
+    if (p == end) return NULL;
+    int match = (size_t)(p - k) == keylen && !memcmp(k, key, keylen);
+    p = skip_ws(p + 1, end);
+    if (p == end || *p++ != ':') return NULL;
+    p = skip_ws(p, end);
+    if (p == end) return NULL;
+    v = p;
+    p = skip_value(p, end);
+    if (match) {
+      *valuelen = p - v;
+      return v;
+    }
+    p = skip_ws(p, end);
+    if (p == end || *p++ != ',') return NULL;
+  }
+}
+
+char const* json_field(char const* rec, size_t len, char const* key, size_t* fieldlen) {
+  char const *v = json_value(rec, len, key, fieldlen), *q;
+  if (!v || *v != '"') return NULL;
+  q = string_end(v + 1, v + *fieldlen);
+  if (q == v + *fieldlen) return NULL;
+  *fieldlen = q - v - 1;
+  return v + 1;
+}
+
+static int hex4(char const* p, char const* end, unsigned* u) {
+  unsigned i, d;
+  if (end - p < 4) return 0;
+  for (*u = 0, i = 0; i < 4; ++i) {
+    char c = p[i];
+    if (c >= '0' && c <= '9')
+      d = c - '0';
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      d = (c | 0x20) - 'a' + 10;
+    else
+      return 0;
+    *u = *u << 4 | d;
+  }
+  return 1;
+}
+
+void identify_feed_json(LanguageIdentifier* lid, char const* raw, size_t len) {
+  /* unescaped runs are fed straight from raw; only escapes go through buf */
+  char buf[256];
+  unsigned n = 0, u, lo;
+  char const *p = raw, *end = raw + len, *run = raw;
+  while (p < end) {
+    if (*p != '\\') {
+      ++p;
+      continue;
+    }
+    if (p > run) {
+      if (n) identify_feed(lid, buf, n), n = 0;
+      identify_feed(lid, run, p - run);
+    }
+    if (++p == end) {
+      run = end;
+      break;
+    }
+    switch (*p++) {
+      case 'b': buf[n++] = '\b'; break;
+      case 'f': buf[n++] = '\f'; break;
+      case 'n': buf[n++] = '\n'; break;
+      case 'r': buf[n++] = '\r'; break;
+      case 't': buf[n++] = '\t'; break;
+      case 'u':
+        if (!hex4(p, end, &u)) break;
+        p += 4;
+        if (u >= 0xd800 && u < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' && hex4(p + 2, end, &lo)
+            && lo >= 0xdc00 && lo < 0xe000) {
+          u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+          p += 6;
+        }
+        n += put_utf8(buf + n, u);
+        break;
+      default: buf[n++] = p[-1]; /* \" \\ \/ */
+    }
+    if (n > sizeof(buf) - 4) identify_feed(lid, buf, n), n = 0;
+    run = p;
+  }
+  if (n) identify_feed(lid, buf, n);
+  if (end > run) identify_feed(lid, run, end - run);
+}
@@ -0,0 +1,33 @@
+#ifndef _FIELDS_H
+#define _FIELDS_H
+
+#include "liblangid.h"
+#include <stddef.h>
+
+/* Locate fields of a line record in place, without copying the record.
+ * Both return a pointer into rec (or NULL if the field is absent) and set
+ * *fieldlen.
+ */
+
+/** the col'th (0-based) tab-separated column; a trailing newline is not part
+    of the last column */
+extern char const* tsv_field(char const* rec, size_t len, unsigned col, size_t* fieldlen);
+
+/** the value of top-level member key of a JSON object, as it is in rec
+    (a string with its quotes); NULL if rec isn't an object or has no such
+    member */
+extern char const* json_value(char const* rec, size_t len, char const* key, size_t* valuelen);
+
+/** the first non-blank byte of rec if it is '{', and the last one is '}'
+    (the JSON object rec presumably is); NULL otherwise */
+extern char const* json_object(char const* rec, size_t len, size_t* objectlen);
+
+/** the value of top-level string member key of a JSON object, still escaped
+    (i.e. the bytes between the quotes) */
+extern char const* json_field(char const* rec, size_t len, char const* key, size_t* fieldlen);
+
+/** identify_feed the result of decoding the JSON string escapes in
+    raw[0..len) (as returned by json_field), without a decoded copy */
+extern void identify_feed_json(LanguageIdentifier*, char const* raw, size_t len);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Export of sparse feature vectors in a binary CSR format; see fvexport.h
+ */
+
+#include "fvexport.h"
+#include "sparseset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void put_u32(unsigned char* b, uint32_t x) {
+  b[0] = x, b[1] = x >> 8, b[2] = x >> 16, b[3] = x >> 24;
+}
+
+static void put_u64(unsigned char* b, uint64_t x) {
+  put_u32(b, (uint32_t)x);
+  put_u32(b + 4, (uint32_t)(x >> 32));
+}
+
+static void write_or_die(void const* p, size_t size, size_t n, FILE* f) {
+  if (fwrite(p, size, n, f) != n) {
+    fprintf(stderr, "error writing feature vectors\n");
+    exit(-1);
+  }
+}
+
+static void pad8(FILE* f, uint64_t* off) {
+  static char const zero[8];
+  unsigned pad = (8 - (*off & 7)) & 7;
+  write_or_die(zero, 1, pad, f);
+  *off += pad;
+}
+
+static int cmp_u64(void const* a, void const* b) {
+  uint64_t x = *(uint64_t const*)a, y = *(uint64_t const*)b;
+  return x < y ? -1 : x > y;
+}
+
+FvWriter* open_fv_writer(char const* path, unsigned num_feats) {
+  FvWriter* w;
+  unsigned char header[FV_HEADER_SIZE] = {0};
+  if ((w = (FvWriter*)malloc(sizeof(FvWriter))) == 0) exit(-1);
+  if ((w->row = (uint64_t*)malloc(num_feats * sizeof(uint64_t))) == 0) exit(-1);
+  if (!(w->f = fopen(path, "wb")) || !(w->data = tmpfile()) || !(w->indptr = tmpfile())) {
+    fprintf(stderr, "unable to open: %s\n", path);
+    exit(-1);
+  }
+  w->num_feats = num_feats;
+  w->num_docs = w->nnz = 0;
+  /* the header is rewritten by close; indices follow it directly */
+  write_or_die(header, 1, FV_HEADER_SIZE, w->f);
+  write_or_die(&w->nnz, sizeof(uint64_t), 1, w->indptr);
+  return w;
+}
+
+void fv_writer_add(FvWriter* w, Set const* fv) {
+  unsigned i, n = fv->members;
+  int32_t feat;
+  uint32_t count;
+  /* feature id in the high half, so sorting orders the row by feature */
+  for (i = 0; i < n; i++) w->row[i] = (uint64_t)fv->dense[i] << 32 | fv->counts[i];
+  qsort(w->row, n, sizeof(uint64_t), cmp_u64);
+  for (i = 0; i < n; i++) {
+    feat = (int32_t)(w->row[i] >> 32);
+    count = (uint32_t)w->row[i];
+    write_or_die(&feat, sizeof(feat), 1, w->f);
+    write_or_die(&count, sizeof(count), 1, w->data);
+  }
+  w->nnz += n;
+  ++w->num_docs;
+  write_or_die(&w->nnz, sizeof(uint64_t), 1, w->indptr);
+}
+
+void fv_writer_add_empty(FvWriter* w) {
+  ++w->num_docs;
+  write_or_die(&w->nnz, sizeof(uint64_t), 1, w->indptr);
+}
+
+/* append the spooled section in tmp to w->f, narrowing 8-byte entries to
+ * 4 bytes if narrow is set */
+static void append(FvWriter* w, FILE* tmp, int narrow, uint64_t* off) {
+  unsigned char buf[1 << 16];
+  size_t n, i;
+  rewind(tmp);
+  while ((n = fread(buf, 1, sizeof(buf), tmp))) {
+    if (narrow) {
+      for (i = 0; i < n / 8; i++) {
+        int32_t x = (int32_t) * (uint64_t*)(buf + 8 * i);
+        memcpy(buf + 4 * i, &x, 4);
+      }
+      n /= 2;
+    }
+    write_or_die(buf, 1, n, w->f);
+    *off += n;
+  }
+  fclose(tmp);
+}
+
+void close_fv_writer(FvWriter* w) {
+  unsigned char header[FV_HEADER_SIZE] = {0};
+  uint64_t off = FV_HEADER_SIZE + 4 * w->nnz, data_offset, indptr_offset;
+  int narrow = w->nnz < (1u << 31);
+
+  pad8(w->f, &off);
+  data_offset = off;
+  append(w, w->data, 0, &off);
+  pad8(w->f, &off);
+  indptr_offset = off;
+  append(w, w->indptr, narrow, &off);
+
+  memcpy(header, "LIDF", 4);
+  put_u32(header + 4, FV_VERSION);
+  put_u32(header + 8, w->num_feats);
+  put_u32(header + 12, narrow ? 4 : 8);
+  put_u64(header + 16, w->num_docs);
+  put_u64(header + 24, w->nnz);
+  put_u64(header + 32, FV_HEADER_SIZE);
+  put_u64(header + 40, data_offset);
+  put_u64(header + 48, indptr_offset);
+  rewind(w->f);
+  write_or_die(header, 1, FV_HEADER_SIZE, w->f);
+  if (fclose(w->f)) {
+    fprintf(stderr, "error writing feature vectors\n");
+    exit(-1);
+  }
+  free(w->row);
+  free(w);
+}
@@ -0,0 +1,42 @@
+#ifndef _FVEXPORT_H
+#define _FVEXPORT_H
+
+#include "sparseset.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* Binary CSR export of per-document feature vectors (one row per document,
+ * one column per model feature, values are n-gram counts), laid out so that
+ * langid_fv.py can mmap it into a scipy.sparse.csr_matrix without copying.
+ *
+ * layout (little-endian - the writer assumes a little-endian host - with
+ * sections 8-byte aligned):
+ *   header (64 bytes): "LIDF" u32 version u32 num_feats u32 indptr_size
+ *     u64 num_docs u64 nnz u64 indices_offset u64 data_offset
+ *     u64 indptr_offset, zero padding
+ *   indices: int32[nnz], feature ids, sorted within each row
+ *   data: uint32[nnz], counts
+ *   indptr: int32 or int64 (indptr_size bytes) [num_docs + 1] - the document
+ *     index: row i is indices/data[indptr[i] .. indptr[i+1])
+ *
+ * indptr is int32 when nnz < 2^31 so that scipy can use indices as-is.
+ */
+
+#define FV_VERSION 1
+#define FV_HEADER_SIZE 64
+
+typedef struct {
+  FILE *f, *data, *indptr; /* data and indptr are spooled, then appended */
+  unsigned num_feats;
+  uint64_t num_docs, nnz;
+  uint64_t* row; /* scratch for sorting a row */
+} FvWriter;
+
+extern FvWriter* open_fv_writer(char const* path, unsigned num_feats);
+/** append fv (e.g. from identify_features) as the next row */
+extern void fv_writer_add(FvWriter*, Set const* fv);
+/** append an empty row, e.g. for a document that couldn't be read */
+extern void fv_writer_add_empty(FvWriter*);
+extern void close_fv_writer(FvWriter*);
+
+#endif
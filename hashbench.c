@@ -0,0 +1,142 @@
+/*
+ * Compare the hashed n-gram engine (scan hash) with the DFA walk:
+ *
+ *   hashbench [-m model] [-s sizes] < corpus
+ *
+ * cuts stdin into documents of each size, checks that both engines give
+ * identical feature counts for every document, and reports the throughput
+ * of each.
+ */
+
+#include "hashfv.h"
+#include "liblangid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+char const *getoptspec = "hm:s:";
+
+void usage() {
+  printf("hashbench [-m model] [-s sizes] < corpus (%s)\n"
+         "\n -m: load model file"
+         "\n -s: comma-separated document sizes in bytes (default "
+         "16,64,256,1024,4096,65536)"
+         "\n\n",
+         getoptspec);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* fv as counts indexed by feature; 0 if a and b differ */
+static int same_counts(Set const *a, Set const *b, unsigned *dense) {
+  unsigned i;
+  if (a->members != b->members)
+    return 0;
+  for (i = 0; i < a->members; i++)
+    dense[a->dense[i]] = a->counts[i];
+  for (i = 0; i < b->members; i++)
+    if (dense[b->dense[i]] != b->counts[i])
+      return 0;
+  for (i = 0; i < a->members; i++)
+    dense[a->dense[i]] = 0;
+  return 1;
+}
+
+/* MB/s over the corpus in docs of size bytes, taking at least 0.2s */
+static double throughput(LanguageIdentifier *lid, char const *text, size_t len,
+                         size_t size) {
+  size_t off, bytes = 0;
+  double t = now(), dt;
+  do {
+    for (off = 0; off + size <= len; off += size)
+      identify_features(lid, text + off, size);
+    bytes += len - len % size;
+  } while ((dt = now() - t) < 0.2);
+  return bytes / dt / 1e6;
+}
+
+int main(int argc, char **argv) {
+  char *model_path = NULL, *sizes = "16,64,256,1024,4096,65536", *text = NULL,
+       *end;
+  size_t text_size = 0, len, size, off, differ;
+  unsigned *dense;
+  LanguageIdentifier *lid;
+  FeatureHash *h;
+  LangidConfig cfg;
+  double dfa, hash;
+  int c;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'm':
+      model_path = optarg;
+      break;
+    case 's':
+      sizes = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+
+  len = getdelim(&text, &text_size, EOF, stdin);
+  if ((ssize_t)len <= 0) {
+    fprintf(stderr, "hashbench: no input\n");
+    return 1;
+  }
+  lid = model_path ? load_identifier(model_path) : get_default_identifier();
+  if ((h = build_feature_hash(lid)) == NULL) {
+    fprintf(stderr, "hashbench: the model has features longer than %d bytes\n",
+            HASHFV_MAX_LEN);
+    return 1;
+  }
+  printf("feature table: %u slots (%zu KB) vs DFA %zu KB; hashed lengths",
+         HASHFV_BUCKET << (64 - h->shift),
+         (((size_t)HASHFV_BUCKET << (64 - h->shift)) *
+              (sizeof(uint64_t) + sizeof(unsigned)) +
+          HASHFV_DIRECT * sizeof(unsigned)) >> 10,
+         (size_t)lid->num_states * 256 * sizeof(unsigned) >> 10);
+  for (c = 0; c < (int)h->num_lens; c++)
+    printf(" %u", h->lens[c]);
+  printf("\n%8s %12s %12s %8s\n", "size", "dfa MB/s", "hash MB/s", "speedup");
+
+  if ((dense = (unsigned *)calloc(lid->num_feats, sizeof(unsigned))) == 0)
+    exit(-1);
+  default_config(&cfg);
+  for (; *sizes; sizes = *end ? end + 1 : end) {
+    if (!(size = strtoul(sizes, &end, 10)) || size > len)
+      continue;
+    for (differ = off = 0; off + size <= len; off += size) {
+      text_to_fv(lid, text + off, size, lid->sv, lid->fv);
+      hash_text_to_fv(h, text + off, size, lid->sv);
+      differ += !same_counts(lid->fv, lid->sv, dense);
+    }
+    if (differ) {
+      fprintf(stderr, "hashbench: %zu documents of %zu bytes differ\n", differ,
+              size);
+      return 1;
+    }
+    cfg.scan = SCAN_MASK;
+    set_engine(lid, &cfg);
+    dfa = throughput(lid, text, len, size);
+    cfg.scan = SCAN_HASH;
+    set_engine(lid, &cfg);
+    hash = throughput(lid, text, len, size);
+    printf("%8zu %12.2f %12.2f %8.2f\n", size, dfa, hash, hash / dfa);
+  }
+
+  free_feature_hash(h);
+  free(dense);
+  destroy_identifier(lid);
+  free(text);
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Hashed n-gram engine; see hashfv.h
+ */
+
+#include "hashfv.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHFV_MUL 0x9e3779b97f4a7c15ull
+#define HASHFV_BLOCK 64
+#define NONE ((unsigned)-1)
+
+static uint64_t len_mask(unsigned len) {
+  return ((uint64_t)1 << 8 * len) - 1;
+}
+
+static unsigned bucket_of(unsigned shift, uint64_t key) {
+  return (unsigned)((key * HASHFV_MUL) >> shift);
+}
+
+/* fill the buckets with the n keys; 0 if one overflows */
+static int fill(FeatureHash* h, uint64_t const* keys, unsigned const* feats, unsigned n) {
+  size_t slots = (size_t)HASHFV_BUCKET << (64 - h->shift), b;
+  unsigned i, k;
+  free(h->keys);
+  free(h->feats);
+  if ((h->keys = (uint64_t*)aligned_alloc(HASHFV_BUCKET * sizeof(uint64_t), slots * sizeof(uint64_t))) == 0) exit(-1);
+  if ((h->feats = (unsigned*)calloc(slots, sizeof(unsigned))) == 0) exit(-1);
+  memset(h->keys, 0, slots * sizeof(uint64_t));
+  for (i = 0; i < n; i++) {
+    b = (size_t)HASHFV_BUCKET * bucket_of(h->shift, keys[i]);
+    for (k = 0; k < HASHFV_BUCKET && h->keys[b + k]; k++)
+      ;
+    if (k == HASHFV_BUCKET) return 0;
+    h->keys[b + k] = keys[i];
+    h->feats[b + k] = feats[i];
+  }
+  return 1;
+}
+
+FeatureHash* build_feature_hash(LanguageIdentifier* lid) {
+  unsigned n = lid->num_states, f, i, j, s, t, d, bits, nkeys = 0, *queue, *parent, *depth, *state, *feats = NULL;
+  unsigned char *last, seen[HASHFV_MAX_LEN + 1] = {0};
+  FeatureHash* h = NULL;
+  uint64_t key, *keys = NULL;
+
+  if ((queue = (unsigned*)malloc(n * sizeof(unsigned))) == 0) exit(-1);
+  if ((parent = (unsigned*)malloc(n * sizeof(unsigned))) == 0) exit(-1);
+  if ((depth = (unsigned*)malloc(n * sizeof(unsigned))) == 0) exit(-1);
+  if ((last = (unsigned char*)malloc(n)) == 0) exit(-1);
+  if ((state = (unsigned*)malloc(lid->num_feats * sizeof(unsigned))) == 0) exit(-1);
+
+  /* breadth first, so each state is first reached by its own string */
+  for (s = 0; s < n; s++)
+    depth[s] = NONE;
+  depth[0] = 0;
+  queue[0] = 0;
+  for (i = 0, j = 1; i < j; i++) {
+    s = queue[i];
+    for (d = 0; d < 256; d++) {
+      t = TK_STATE((*lid->tk_nextmove)[s][d]);
+      if (depth[t] != NONE) continue;
+      depth[t] = depth[s] + 1;
+      parent[t] = s;
+      last[t] = d;
+      queue[j++] = t;
+    }
+  }
+
+  for (f = 0; f < lid->num_feats; f++)
+    state[f] = NONE;
+  for (s = 0; s < n; s++)
+    if (depth[s] != NONE)
+      for (i = 0; i < (*lid->tk_output_c)[s]; i++) {
+        f = (*lid->tk_output)[(*lid->tk_output_s)[s] + i];
+        if (state[f] == NONE || depth[s] < depth[state[f]]) state[f] = s;
+      }
+
+  if ((h = (FeatureHash*)malloc(sizeof(FeatureHash))) == 0) exit(-1);
+  if ((h->direct = (unsigned*)calloc(HASHFV_DIRECT, sizeof(unsigned))) == 0) exit(-1);
+  h->keys = NULL;
+  h->feats = NULL;
+  if ((keys = (uint64_t*)malloc(lid->num_feats * sizeof(uint64_t))) == 0) exit(-1);
+  if ((feats = (unsigned*)malloc(lid->num_feats * sizeof(unsigned))) == 0) exit(-1);
+
+  for (f = 0; f < lid->num_feats; f++) {
+    if ((s = state[f]) == NONE) continue; /* never output */
+    d = depth[s];
+    if (d == 0 || d > HASHFV_MAX_LEN) goto unsupported;
+    key = (uint64_t)1 << 8 * d;
+    for (i = 0; s; s = parent[s], i++)
+      key |= (uint64_t)last[s] << 8 * i;
+    if (d <= 2) {
+      h->direct[d == 1 ? key & 0xff : 256 + (key & 0xffff)] = f + 1;
+    } else {
+      keys[nkeys] = key;
+      feats[nkeys++] = f;
+    }
+    seen[d] = 1;
+  }
+  h->num_lens = 0;
+  for (d = 3; d <= HASHFV_MAX_LEN; d++)
+    if (seen[d]) h->lens[h->num_lens++] = d;
+
+  /* start from a load of one key per bucket */
+  for (bits = 4; ((unsigned)1 << bits) < nkeys; bits++)
+    ;
+  for (;; bits++) {
+    if (bits > 24) goto unsupported; /* only if keys repeat */
+    h->shift = 64 - bits;
+    if (fill(h, keys, feats, nkeys)) break;
+  }
+  goto done;
+
+unsupported:
+  free_feature_hash(h);
+  h = NULL;
+done:
+  free(queue);
+  free(parent);
+  free(depth);
+  free(last);
+  free(state);
+  free(keys);
+  free(feats);
+  return h;
+}
+
+void free_feature_hash(FeatureHash* h) {
+  if (!h) return;
+  free(h->direct);
+  free(h->keys);
+  free(h->feats);
+  free(h);
+}
+
+/*
+ * A block of text at a time: first the window of the last 8 bytes at each
+ * position, then each n-gram length's lookups for the whole block. Unlike
+ * the DFA walk, where each move depends on the last, the lookups are
+ * independent, so their cache misses overlap, and they only append the
+ * features found to hit[], without branching on whether there are any.
+ */
+void hash_text_to_fv(FeatureHash const* h, char const* text, unsigned textlen, Set* fv) {
+  uint64_t w = 0, win[HASHFV_BLOCK], lmask, tag, key;
+  uint64_t const* b;
+  unsigned hit[HASHFV_BLOCK * (2 + HASHFV_MAX_LEN)], shift = h->shift;
+  unsigned i, j, k, n, m, len, f, e1, e2, e3;
+
+  clear(fv);
+
+  for (i = 0; i < textlen; i += n) {
+    n = textlen - i < HASHFV_BLOCK ? textlen - i : HASHFV_BLOCK;
+    m = 0;
+    for (j = 0; j < n; j++) {
+      win[j] = w = w << 8 | (unsigned char)text[i + j];
+      hit[m] = (f = h->direct[w & 0xff]) - 1;
+      m += f != 0;
+    }
+    /* n-grams start at or after the first byte */
+    for (j = i ? 0 : 1; j < n; j++) {
+      hit[m] = (f = h->direct[256 + (win[j] & 0xffff)]) - 1;
+      m += f != 0;
+    }
+    for (k = 0; k < h->num_lens; k++) {
+      len = h->lens[k];
+      lmask = len_mask(len);
+      tag = lmask + 1;
+      for (j = i + 1 >= len ? 0 : len - 1 - i; j < n; j++) {
+        key = (win[j] & lmask) | tag;
+        b = h->keys + HASHFV_BUCKET * bucket_of(shift, key);
+        /* unrolled for HASHFV_BUCKET 4 */
+        e1 = b[1] == key;
+        e2 = b[2] == key;
+        e3 = b[3] == key;
+        hit[m] = h->feats[b - h->keys + e1 + 2 * e2 + 3 * e3];
+        m += (b[0] == key) | e1 | e2 | e3;
+      }
+    }
+    for (j = 0; j < m; j++)
+      add(fv, hit[j], 1);
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef _HASHFV_H
+#define _HASHFV_H
+
+#include "liblangid.h"
+#include "sparseset.h"
+#include <stdint.h>
+
+/* Hashed n-gram engine (scan hash): instead of walking the tokenizer DFA,
+ * look up every byte n-gram of the lengths the model uses in a small open
+ * addressing table of the model's features. The feature strings aren't
+ * stored in the model, so they are recovered from the DFA: the first
+ * (shortest) path to each state spells that state's string, and a feature
+ * is the string of the shallowest state that outputs it.
+ *
+ * Unigrams and bigrams index a direct table of feature + 1 (0: none). A
+ * longer n-gram, of length L <= HASHFV_MAX_LEN, is keyed by its bytes, last
+ * byte lowest, with bit 8L set to mark the length, so keys are never 0
+ * (empty). Keys hash to a bucket of HASHFV_BUCKET slots, which is all a
+ * lookup reads, so it compares them without branching; the table is grown
+ * until no bucket overflows.
+ */
+
+#define HASHFV_MAX_LEN 7
+
+#define HASHFV_DIRECT (256 + 65536)
+#define HASHFV_BUCKET 4
+
+typedef struct FeatureHash {
+  unsigned* direct; /* [b] for unigram b, [256 + (a << 8 | b)] for bigram ab */
+  uint64_t* keys; /* HASHFV_BUCKET per bucket */
+  unsigned* feats;
+  unsigned shift; /* bucket = (key * multiplier) >> shift */
+  unsigned num_lens;
+  unsigned char lens[HASHFV_MAX_LEN]; /* the hashed lengths that occur (> 2) */
+} FeatureHash;
+
+/** NULL if the model has a feature longer than HASHFV_MAX_LEN */
+extern FeatureHash* build_feature_hash(LanguageIdentifier*);
+extern void free_feature_hash(FeatureHash*);
+/** the same feature counts in fv as text_to_fv */
+extern void hash_text_to_fv(FeatureHash const*, char const*, unsigned, Set* fv);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * JMH comparison of one JNI call per document against batch calls.
+ *
+ *   mvn -f java/pom.xml -P jmh package && \
+ *   java -Djava.library.path=. -jar java/target/benchmarks.jar
+ */
+package langid;
+
+import java.io.ByteArrayOutputStream;
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.util.Random;
+import java.util.concurrent.TimeUnit;
+import org.openjdk.jmh.annotations.*;
+
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class LangIdBenchmark {
+  static final String[] SAMPLES = {
+      "the quick brown fox jumps over the lazy dog ",
+      "der schnelle braune Fuchs springt über den faulen Hund ",
+      "le renard brun rapide saute par-dessus le chien paresseux ",
+      "el rápido zorro marrón salta sobre el perro perezoso "};
+
+  /** document length in characters */
+  @Param({"16", "64", "256", "4096"})
+  int length;
+
+  /** documents per batch (and per invocation, for the single-call loops);
+      a constant, as @OperationsPerInvocation must be */
+  static final int DOCS = 1024;
+
+  LangId langid;
+  byte[] heap;
+  ByteBuffer direct;
+  int[] offsets, results;
+
+  @Setup
+  public void setup() {
+    langid = new LangId();
+    Random random = new Random(1);
+    ByteArrayOutputStream all = new ByteArrayOutputStream();
+    offsets = new int[DOCS + 1];
+    results = new int[DOCS];
+    for (int i = 0; i < DOCS; i++) {
+      StringBuilder doc = new StringBuilder();
+      String sample = SAMPLES[random.nextInt(SAMPLES.length)];
+      while (doc.length() < length) doc.append(sample);
+      byte[] bytes = doc.substring(0, length).getBytes(StandardCharsets.UTF_8);
+      all.write(bytes, 0, bytes.length);
+      offsets[i + 1] = all.size();
+    }
+    heap = all.toByteArray();
+    direct = ByteBuffer.allocateDirect(heap.length);
+    direct.put(heap).flip();
+  }
+
+  @TearDown
+  public void tearDown() {
+    langid.close();
+  }
+
+  @Benchmark
+  @OperationsPerInvocation(DOCS)
+  public int singleArray() {
+    int sum = 0;
+    for (int i = 0; i < DOCS; i++) sum += langid.identify(heap, offsets[i], offsets[i + 1] - offsets[i]);
+    return sum;
+  }
+
+  @Benchmark
+  @OperationsPerInvocation(DOCS)
+  public int singleDirect() {
+    int sum = 0;
+    for (int i = 0; i < DOCS; i++) {
+      direct.limit(offsets[i + 1]).position(offsets[i]);
+      sum += langid.identify(direct);
+    }
+    direct.clear();
+    return sum;
+  }
+
+  @Benchmark
+  @OperationsPerInvocation(DOCS)
+  public int[] batchArray() {
+    langid.identifyBatch(heap, offsets, DOCS, results);
+    return results;
+  }
+
+  @Benchmark
+  @OperationsPerInvocation(DOCS)
+  public int[] batchDirect() {
+    langid.identifyBatch(direct, offsets, DOCS, results);
+    return results;
+  }
+}
@@ -0,0 +1,109 @@
+/*
+ * Java binding to liblangid (see langid_jni.c).
+ */
+package langid;
+
+import java.nio.ByteBuffer;
+
+/**
+ * A language identifier. Text is UTF-8 bytes, read in place from direct
+ * ByteBuffers or byte[] regions. Any number of threads may share one
+ * LangId; each gets its own native scoring scratch on first use. close()
+ * must not race with identification calls.
+ */
+public final class LangId implements AutoCloseable {
+  static {
+    System.loadLibrary("langid_jni");
+  }
+
+  private long handle;
+  private final String[] languages;
+
+  /** the built-in model */
+  public LangId() {
+    this(null);
+  }
+
+  /** a protocol-buffer model file, or the built-in model if path is null */
+  public LangId(String path) {
+    handle = load(path);
+    languages = languages(handle);
+  }
+
+  /** language codes, indexed by the values identify returns */
+  public String[] languages() {
+    return languages.clone();
+  }
+
+  public String language(int index) {
+    return languages[index];
+  }
+
+  /** identify buf's remaining bytes; its position is not changed */
+  public int identify(ByteBuffer buf) {
+    if (buf.isDirect()) return identifyDirect(handle(), buf, buf.position(), buf.remaining());
+    if (buf.hasArray())
+      return identify(buf.array(), buf.arrayOffset() + buf.position(), buf.remaining());
+    byte[] copy = new byte[buf.remaining()];
+    buf.duplicate().get(copy);
+    return identify(copy, 0, copy.length);
+  }
+
+  public int identify(byte[] text, int off, int len) {
+    checkRange(text.length, off, len);
+    return identifyArray(handle(), text, off, len);
+  }
+
+  public int identify(byte[] text) {
+    return identifyArray(handle(), text, 0, text.length);
+  }
+
+  /**
+   * identify n documents in one call: document i is bytes offsets[i] to
+   * offsets[i+1] of text (relative to index 0 of a direct buffer); its
+   * language index goes to results[i]
+   */
+  public void identifyBatch(ByteBuffer text, int[] offsets, int n, int[] results) {
+    checkBatch(text.capacity(), offsets, n, results);
+    if (!text.isDirect()) throw new IllegalArgumentException("identifyBatch needs a direct ByteBuffer");
+    identifyBatchDirect(handle(), text, offsets, n, results);
+  }
+
+  public void identifyBatch(byte[] text, int[] offsets, int n, int[] results) {
+    checkBatch(text.length, offsets, n, results);
+    identifyBatchArray(handle(), text, offsets, n, results);
+  }
+
+  @Override
+  public synchronized void close() {
+    if (handle != 0) {
+      free(handle);
+      handle = 0;
+    }
+  }
+
+  private long handle() {
+    long h = handle;
+    if (h == 0) throw new IllegalStateException("LangId is closed");
+    return h;
+  }
+
+  private static void checkRange(int size, int off, int len) {
+    if (off < 0 || len < 0 || off > size - len) throw new IndexOutOfBoundsException();
+  }
+
+  private static void checkBatch(int size, int[] offsets, int n, int[] results) {
+    if (n < 0 || offsets.length < n + 1 || results.length < n) throw new IndexOutOfBoundsException();
+    for (int i = 0; i < n; i++)
+      if (offsets[i] < 0 || offsets[i] > offsets[i + 1]) throw new IndexOutOfBoundsException();
+    if (n > 0 && offsets[n] > size) throw new IndexOutOfBoundsException();
+  }
+
+  private static native long load(String path);
+  private static native void free(long handle);
+  private static native String[] languages(long handle);
+  private static native int identifyDirect(long handle, ByteBuffer buf, int off, int len);
+  private static native int identifyArray(long handle, byte[] text, int off, int len);
+  private static native void identifyBatchDirect(long handle, ByteBuffer text, int[] offsets, int n, int[] results);
+  private static native void identifyBatchArray(long handle, byte[] text, int[] offsets, int n, int[] results);
+}
@@ -0,0 +1,84 @@
+/*
+ * Checkpoint journal for resuming interrupted batch runs; see journal.h
+ */
+
+#include "journal.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void journal_error(Journal* j, char const* what) {
+  fprintf(stderr, "journal %s: %s: %s\n", j->path, what, strerror(errno));
+  exit(-1);
+}
+
+Journal* open_journal(char const* path) {
+  Journal* j;
+  FILE* f;
+  long long in_off, out_off;
+
+  if ((j = (Journal*)malloc(sizeof(Journal))) == 0) exit(-1);
+  j->path = strdup(path);
+  if ((j->tmp = (char*)malloc(strlen(path) + 5)) == 0) exit(-1);
+  sprintf(j->tmp, "%s.tmp", path);
+  j->in_off = j->out_off = 0;
+  j->resumed = 0;
+  j->last = time(NULL);
+
+  if ((f = fopen(path, "r"))) {
+    if (fscanf(f, "%lld %lld", &in_off, &out_off) != 2) {
+      fprintf(stderr, "journal %s is corrupt\n", path);
+      exit(-1);
+    }
+    fclose(f);
+    j->in_off = in_off;
+    j->out_off = out_off;
+    j->resumed = 1;
+  } else if (errno != ENOENT)
+    journal_error(j, "open");
+  return j;
+}
+
+void journal_resume(Journal* j, FILE* in, FILE* out) {
+  char buf[1 << 16];
+  off_t skip;
+  size_t n;
+
+  if (ftruncate(fileno(out), j->out_off) || fseeko(out, j->out_off, SEEK_SET)) journal_error(j, "truncating output");
+  /* the input may be a pipe replaying the same path list; if so, discard */
+  if (in && fseeko(in, j->in_off, SEEK_SET))
+    for (skip = j->in_off; skip; skip -= n)
+      if (!(n = fread(buf, 1, skip < (off_t)sizeof(buf) ? skip : (off_t)sizeof(buf), in))) {
+        fprintf(stderr, "journal %s: input is shorter than the journaled offset\n", j->path);
+        exit(-1);
+      }
+  fprintf(stderr, "resuming from input byte %lld, output byte %lld\n", (long long)j->in_off,
+          (long long)j->out_off);
+}
+
+void journal_checkpoint(Journal* j, off_t in_off, FILE* out) {
+  FILE* f;
+  /* the output must be durable before the journal says it's there */
+  if (fflush(out) || fdatasync(fileno(out))) journal_error(j, "flushing output");
+  j->in_off = in_off;
+  j->out_off = ftello(out);
+  if (!(f = fopen(j->tmp, "w"))) journal_error(j, "open");
+  fprintf(f, "%lld %lld\n", (long long)j->in_off, (long long)j->out_off);
+  if (fflush(f) || fdatasync(fileno(f)) || fclose(f)) journal_error(j, "write");
+  if (rename(j->tmp, j->path)) journal_error(j, "rename");
+  j->last = time(NULL);
+}
+
+void journal_tick(Journal* j, off_t in_off, FILE* out) {
+  if (time(NULL) - j->last >= JOURNAL_INTERVAL) journal_checkpoint(j, in_off, out);
+}
+
+void close_journal(Journal* j, off_t in_off, FILE* out) {
+  journal_checkpoint(j, in_off, out);
+  if (unlink(j->path)) journal_error(j, "unlink");
+  free(j->path);
+  free(j->tmp);
+  free(j);
+}
@@ -0,0 +1,36 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Checkpoint journal for long batch runs: records how far into the input
+ * (path list) the run got, and the size of the output at that point. Every
+ * result for input before in_off is in the first out_off bytes of the
+ * output, and nothing else is, so a restarted run truncates the output to
+ * out_off and continues reading the input at in_off.
+ */
+typedef struct {
+  char *path, *tmp;
+  off_t in_off, out_off;
+  int resumed;
+  time_t last;
+} Journal;
+
+/** read the journal at path if it exists (resumed is set) */
+extern Journal* open_journal(char const* path);
+/** position out and in (unless NULL) as the journal says, for a resumed run */
+extern void journal_resume(Journal*, FILE* in, FILE* out);
+/** flush out to disk and atomically record in_off and out's size */
+extern void journal_checkpoint(Journal*, off_t in_off, FILE* out);
+/** journal_checkpoint at most once every JOURNAL_INTERVAL seconds */
+extern void journal_tick(Journal*, off_t in_off, FILE* out);
+/** final checkpoint; the journal is removed once the run is complete */
+extern void close_journal(Journal*, off_t in_off, FILE* out);
+
+#ifndef JOURNAL_INTERVAL
+#define JOURNAL_INTERVAL 10
+#endif
+
+#endif
@@ -6,23 +6,46 @@
  * Jonathan Graehl <graehl@gmail.com> 2017
  */
 
+#include "autotune.h"
+#include "config.h"
+#include "fields.h"
+#include "fvexport.h"
+#include "journal.h"
+#include "layout.h"
 #include "liblangid.h"
+#include "neardup.h"
+#include "probes.h"
+#include "records.h"
+#include "ringserve.h"
+#include "sample.h"
+#include "shard.h"
+#include "sidecar.h"
+#include "transcode.h"
+#include "zout.h"
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
 
-char const *getoptspec = "hpdlbmv:e:i:o:gj:D:L:f:I:F:";
+char const *getoptspec = "hpdlbm:0Pv:e:i:o:gj:D:L:f:I:F:t:J:x:V:k:s:S:R:w:N:E:H:O:";
 
 void usage() {
-  printf("Options (stdin/stdout): %s\n"
-         "\n -v N: verbose level N"
+  printf("Usage: langid [options] | langid autotune [options] [sample...]\n"
+         "\nOptions (stdin/stdout): %s\n"
+         "\n -v N: verbose level N (2: report model load and teardown costs)"
          "\n -f: input from file instead of stdin"
-         "\n -F: output instead of stdout"
+         "\n -F: output instead of stdout (-F, -o and -j outputs ending in .gz "
+         "or .zst are compressed on -w threads)"
          "\n -l: line-mode"
+         "\n -0: line-mode records and batch-mode paths are NUL-terminated "
+         "instead of lines, and so are batch-mode results"
+         "\n -P: line-mode records and batch-mode paths are each preceded by "
+         "their length (4 bytes, little-endian), and so are batch-mode results"
          "\n -b: batch-mode"
          "\n -g: grep-mode - keep lines that are ided as lang -e (default en)"
          "\n -i: additional input file (same lines get filtered) for grep-mode"
@@ -36,12 +59,47 @@ void usage() {
          "\n -L: also keep lines with per-token logprob(e) - logprob(most "
          "likely) >= L, i.e. L<0 means tolerate 2nd place"
          "\n -j: rejected lines go here"
+         "\n -t: identify only TSV column N (1-based) of each line; line-mode "
+         "writes the line with a language column added"
+         "\n -J: identify only the top-level string field J of each JSONL "
+         "line; line-mode writes the object with a \"langid\" member added "
+         "(replacing any it has); a line that isn't an object becomes "
+         "{\"langid\":\"NOFIELD\"}"
+         "\n -x: line-mode also writes a language index of the lines to x "
+         "(query it with langidx)"
+         "\n -V: write each document's feature vector to V (binary CSR, "
+         "load with langid_fv.py)"
+         "\n -k: batch-mode checkpoint journal; an interrupted run with the "
+         "same -k, -F and input resumes where it stopped (requires -F)"
+         "\n -s i/N: batch-mode processes only shard i (0..N-1) of the paths, "
+         "by path hash; combine the N outputs with langidmerge"
+         "\n -S i/N: as -s, but shards have balanced total file size (stats "
+         "every path first)"
+         "\n -N t: batch-mode reuses the language of an earlier document whose "
+         "MinHash similarity is >= t (e.g. 0.9) instead of identifying "
+         "near-duplicates; -v 1 reports how many"
+         "\n -O n: batch-mode reads each window of n paths in on-disk order "
+         "(by first extent, else inode), which helps when reads are "
+         "seek-bound; output stays in input order"
+         "\n -E enc: batch- and file-mode documents are in enc (utf-8, utf-16le, "
+         "utf-16be, latin1, cp1252), decoded on the fly, less any BOM for enc; auto detects each "
+         "document's encoding from its BOM or content; -v 1 counts them"
+         "\n -H eps: instead of labels, estimate the share of each language "
+         "(of -l lines or -b files, and of bytes) with 95%% intervals within "
+         "+-eps (e.g. 0.01) from a random sample: random seeks into a line "
+         "file, else a reservoir sample of the input"
+         "\n -R: serve same-host producers through the shared-memory ring "
+         "/dev/shm/R (see ring.h) until the producer closes it; with -v 1, "
+         "report latency percentiles for interactive and bulk documents"
+         "\n -w: worker threads for -R and for compressing outputs (default: "
+         "threads in the autotune config, or 1)"
          "\n\n",
          getoptspec);
 }
 
 const char *no_file = "NOSUCHFILE";
 const char *not_file = "NOTAFILE";
+const char *no_field = "NOFIELD";
 
 const char *lang;
 size_t path_size = 4096, text_size = 4096, text_size2;
@@ -65,12 +123,54 @@ char *fin = NULL;
 char *fout = NULL;
 char *freject = NULL;
 char *fF = NULL;
+char *fx = NULL;
+SidecarWriter *sidecar = NULL;
+char *fV = NULL;
+FvWriter *fvw = NULL;
+char *fk = NULL;
+Journal *journal = NULL;
+Shard shard = {0, 0, 0};
+PathList *paths = NULL;
+size_t path_i = 0;
+off_t in_off = 0;
+
+/* -N: near-duplicate reuse */
+NearDup *neardup = NULL;
+double neardup_threshold = 0;
+
+/* -O: batch-mode paths read per window in on-disk order */
+size_t layout_window = 0;
+
+/* -E: encoding of batch- and file-mode documents; without -E they are
+ * identified as they are, BOM and all, like -l lines */
+int E_flag = 0, encoding = ENC_UTF8;
+Encoding text_enc = ENC_UTF8; /* of the current document */
+size_t text_bom = 0;
+unsigned long long enc_docs[NUM_ENCODINGS];
+
+/* -H: sampled language histogram */
+double hist_eps = 0;
+LangHist *hist = NULL;
+
+/* -R: shared-memory ring service */
+char *ring_name = NULL;
+unsigned workers = 0; /* 0: from host_config() */
+
+/* -0 / -P: binary-safe records instead of lines */
+int framing = FRAME_NEWLINE;
+RecordReader *records = NULL;
 double min_logprob = -0.1;
 double *logprobs = 0;
 FILE *detectin = 0;
 FILE *detectout = 0;
 FILE *in = 0, *out = 0, *reject = 0;
 
+/* -t / -J: identify just one field of each TSV / JSONL line, in place */
+int field_flag = 0;
+unsigned tsv_col = 0;
+char *json_key = NULL;
+ssize_t fieldlen;
+
 char *detok_marker = "__LW_AT__";
 unsigned len_detok_marker = 0;
 int detok_flag;
@@ -80,6 +180,37 @@ char gotline(FILE *in) {
   return textlen != -1;
 }
 
+/* the next line-mode record into text; with -0/-P it points into the input
+ * buffer */
+char gotrecord() {
+  char const *rec;
+  size_t len;
+  if (!records)
+    return gotline(detectin);
+  if (!next_record(records, &rec, &len))
+    return 0;
+  text = (char *)rec;
+  textlen = len;
+  return 1;
+}
+
+/* input bytes taken by the last gotrecord */
+size_t record_size() { return records ? records->consumed : (size_t)textlen; }
+
+/* the next path into path; pathlen is the input bytes it took */
+char gotpath() {
+  char const *rec;
+  size_t len;
+  if (!next_record(records, &rec, &len))
+    return 0;
+  if (len + 1 > path_size || !path)
+    path = realloc(path, path_size = len + 1);
+  memcpy(path, rec, len);
+  path[len] = '\0';
+  pathlen = records->consumed;
+  return 1;
+}
+
 void error(char const *msg) {
   fprintf(stderr, "%s\n", msg);
   exit(-1);
@@ -95,19 +226,54 @@ FILE *openin(char const *name) {
   }
 }
 
+/* wall time and page faults of loading or destroying the model, for -v 2 */
+typedef struct {
+  struct timespec t;
+  struct rusage ru;
+} Cost;
+
+void cost_start(Cost *c) {
+  clock_gettime(CLOCK_MONOTONIC, &c->t);
+  getrusage(RUSAGE_SELF, &c->ru);
+}
+
+void cost_report(Cost *c, char const *what) {
+  Cost end;
+  cost_start(&end);
+  fprintf(stderr, "%s: %.3f ms, %ld minor + %ld major page faults\n", what,
+          (end.t.tv_sec - c->t.tv_sec) * 1e3 +
+              (end.t.tv_nsec - c->t.tv_nsec) / 1e6,
+          end.ru.ru_minflt - c->ru.ru_minflt,
+          end.ru.ru_majflt - c->ru.ru_majflt);
+}
+
 void init() {
+  Cost cost;
   /* load an identifier */
+  cost_start(&cost);
   lid = model_path ? load_identifier(model_path) : get_default_identifier();
+  if (verbose >= 2)
+    cost_report(&cost, model_path ? model_path : "built-in model");
   logprobs = malloc(sizeof(double) * lid->num_langs);
   en_index = get_lang_index(lid, en);
   if (detok_flag)
     len_detok_marker = strlen(detok_marker);
 
-  detectout = fF ? fopen(fF, "w") : stdout;
+  if (fk)
+    journal = open_journal(fk);
+  if (!workers)
+    workers = host_config()->threads;
+  detectout = !fF                           ? stdout
+              : journal && journal->resumed ? fopen(fF, "r+")
+                                            : open_output(fF, workers);
+  if (!detectout) {
+    fprintf(stderr, "ERROR: couldn't open '%s'\n", fF);
+    exit(-1);
+  }
   if (fin || fout) {
     if (fin && fout) {
       in = openin(fin);
-      out = fopen(fout, "w");
+      out = open_output(fout, workers);
     } else
       exit(-1);
   }
@@ -118,7 +284,50 @@ void init() {
       f_index = get_lang_index(lid, flang);
   }
   detectin = ff ? openin(ff) : stdin;
-  reject = freject ? fopen(freject, "w") : 0;
+  if (journal && journal->resumed) {
+    /* with a path list in memory, next_path skips to in_off instead */
+    journal_resume(journal, shard.balanced ? NULL : detectin, detectout);
+    in_off = journal->in_off;
+  }
+  if (b_flag || (l_flag && (framing != FRAME_NEWLINE || hist_eps)))
+    records = open_records(detectin, framing);
+  if (shard.balanced) {
+    paths = read_paths(records);
+    assign_balanced(paths, &shard);
+  }
+  reject = freject ? open_output(freject, workers) : 0;
+  if (fx)
+    sidecar = open_sidecar(fx, lid);
+  if (fV)
+    fvw = open_fv_writer(fV, lid->num_feats);
+  if (neardup_threshold)
+    neardup = open_neardup(neardup_threshold);
+}
+
+/* the next path of this shard into path; in_off is the input offset after
+ * it */
+char next_path() {
+  if (paths) {
+    while (path_i < paths->n) {
+      size_t i = path_i++;
+      if (paths->end[i] <= in_off || !paths->mine[i])
+        continue;
+      in_off = paths->end[i];
+      pathlen = strlen(paths->buf + paths->start[i]);
+      if (pathlen + 1 > (ssize_t)path_size || !path)
+        path = realloc(path, path_size = pathlen + 1);
+      memcpy(path, paths->buf + paths->start[i], pathlen + 1);
+      return 1;
+    }
+    in_off = path_i ? paths->end[path_i - 1] : in_off;
+    return 0;
+  }
+  while (gotpath()) {
+    in_off += pathlen;
+    if (!shard.n || shard_owns(&shard, path))
+      return 1;
+  }
+  return 0;
 }
 
 char *dbuf = NULL;
@@ -140,8 +349,61 @@ ssize_t detok_text() {
   return o - dbuf;
 }
 
+/* identify the -t/-J field of the current line into logprobs. sets fieldlen,
+ * which is -1 (and logprobs are those of empty text) if the field is absent */
+void field_logprobs() {
+  size_t len;
+  char const *f;
+  identify_begin(lid);
+  if (json_key) {
+    if ((f = json_field(text, textlen, json_key, &len)))
+      identify_feed_json(lid, f, len);
+  } else if ((f = tsv_field(text, textlen, tsv_col - 1, &len)))
+    identify_feed(lid, f, len);
+  identify_end_logprobs(lid, logprobs);
+  fieldlen = f ? (ssize_t)len : -1;
+}
+
+/* -J lines that aren't JSON objects, each written as a bare "langid" object */
+unsigned long not_objects = 0;
+
+/* write the current line with a language column (or JSON member) added. a
+ * JSON object's own top-level "langid" member is replaced */
+void put_record(char const *lang, FILE *o) {
+  ssize_t len = textlen, close;
+  char const *obj, *v;
+  size_t objlen, vlen;
+  if (len && text[len - 1] == '\n')
+    --len;
+  if (json_key) {
+    if (!(obj = json_object(text, len, &objlen))) {
+      ++not_objects;
+      fprintf(o, "{\"langid\":\"%s\"}", no_field);
+    } else if ((v = json_value(text, len, "langid", &vlen))) {
+      fwrite(text, 1, v - text, o);
+      fprintf(o, "\"%s\"", lang);
+      fwrite(v + vlen, 1, text + len - (v + vlen), o);
+    } else {
+      ssize_t last = close = obj + objlen - 1 - text;
+      while (last && isspace((unsigned char)text[last - 1]))
+        --last;
+      fwrite(text, 1, close, o);
+      fprintf(o, "%s\"langid\":\"%s\"", text[last - 1] == '{' ? "" : ",",
+              lang);
+      fwrite(text + close, 1, len - close, o);
+    }
+  } else {
+    fwrite(text, 1, len, o);
+    fprintf(o, "\t%s", lang);
+  }
+  putc('\n', o);
+}
+
 LikelyLanguage langid_likely() {
-  if (detok_flag) {
+  if (field_flag) {
+    field_logprobs();
+    return likeliest(lid, logprobs);
+  } else if (detok_flag) {
     ssize_t len = detok_text();
     return identify_likely_logprobs(lid, dbuf, len, logprobs);
   } else
@@ -150,6 +412,165 @@ LikelyLanguage langid_likely() {
 
 char const *langid() { return lang = identify(lid, text, textlen); }
 
+/* mmap the file at p into text and textlen; 0 if it can't be opened */
+char map_doc(char const *p) {
+  if ((fd = open(p, O_RDONLY)) == -1)
+    return 0;
+  textlen = lseek(fd, 0, SEEK_END);
+  text = (char *)mmap(NULL, textlen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  return 1;
+}
+
+void unmap_doc() {
+  /* no need to munmap if textlen is 0 */
+  if (textlen && (munmap(text, textlen) == -1)) {
+    fprintf(stderr, "failed to munmap %s of length %zd \n", path, textlen);
+    exit(-1);
+  }
+  text = NULL;
+  close(fd);
+}
+
+/* identify the document in text, decoding it from its -E encoding on the
+ * fly */
+LangIndex doc_index() {
+  text_bom = 0;
+  text_enc = encoding == ENC_AUTO ? detect_encoding(text, textlen, &text_bom)
+                                  : encoding;
+  if (E_flag && encoding != ENC_AUTO)
+    text_bom = encoding_bom(text, textlen, text_enc);
+  ++enc_docs[text_enc];
+  if (text_enc == ENC_UTF8)
+    return identify_index(lid, text + text_bom, textlen - text_bom);
+  identify_begin(lid);
+  identify_feed_encoded(lid, text + text_bom, textlen - text_bom, text_enc);
+  identify_end_logprobs(lid, logprobs);
+  return likeliest(lid, logprobs).i;
+}
+
+/* the language of a batch- or file-mode document, or of a near-duplicate
+ * seen before (-N) */
+char const *doc_langid() {
+  Sketch sketch;
+  LangIndex i;
+  if (!neardup || !sketch_text(text, textlen, &sketch))
+    i = doc_index();
+  else if ((i = neardup_lookup(neardup, &sketch)) == (LangIndex)-1) {
+    i = doc_index();
+    neardup_add(neardup, &sketch, i);
+  }
+  return lang = get_lang_name(lid, i);
+}
+
+/* the features of text, for -V: identify leaves lid->fv alone for short
+ * texts (decoded documents always go through lid->fv) */
+Set const *text_fv() {
+  return textlen - text_bom <= lid->short_max && text_enc == ENC_UTF8
+             ? identify_features(lid, text + text_bom, textlen - text_bom)
+             : lid->fv;
+}
+
+/* the language of the file at path; textlen is its size */
+char const *path_langid() {
+  /* TODO: ensure that path is a real file.
+   * the main issue is with directories I think, no problem reading from a
+   * pipe or socket presumably. Anything that returns data should be fair
+   * game.*/
+  LANGID_PROBE(doc__start, path);
+  if (!map_doc(path)) {
+    LANGID_PROBE(doc__open, path, -1);
+    lang = no_file;
+    textlen = 0;
+    if (fvw)
+      fv_writer_add_empty(fvw);
+  } else {
+    LANGID_PROBE(doc__open, path, textlen);
+    lang = doc_langid();
+    if (fvw)
+      fv_writer_add(fvw, text_fv());
+    unmap_doc();
+  }
+  LANGID_PROBE(doc__done, path, textlen, lang);
+  return lang;
+}
+
+/* write the batch-mode result path,len,lang in the input's framing, as
+ * paths may contain newlines */
+void put_result(char const *p, ssize_t len, char const *lang) {
+  static char *buf = NULL;
+  static size_t buf_size = 0;
+  size_t n;
+  if (framing == FRAME_NEWLINE) {
+    fprintf(detectout, "%s,%zd,%s\n", p, len, lang);
+    return;
+  }
+  n = snprintf(buf, buf_size, "%s,%zd,%s", p, len, lang);
+  if (n >= buf_size) {
+    if ((buf = realloc(buf, buf_size = n + 1)) == 0)
+      exit(-1);
+    snprintf(buf, buf_size, "%s,%zd,%s", p, len, lang);
+  }
+  write_record(detectout, framing, buf, n);
+}
+
+/* batch-mode with -O: read each window of paths in on-disk order, and
+ * write the results in input order */
+void batch_in_layout_order() {
+  char **win, *own_path;
+  off_t *offs;
+  ssize_t *lens;
+  char const **langs;
+  LayoutKey *keys;
+  size_t *order, n, i;
+
+  if ((win = malloc(layout_window * sizeof(char *))) == 0 ||
+      (offs = malloc(layout_window * sizeof(off_t))) == 0 ||
+      (lens = malloc(layout_window * sizeof(ssize_t))) == 0 ||
+      (langs = malloc(layout_window * sizeof(char const *))) == 0 ||
+      (keys = malloc(layout_window * sizeof(LayoutKey))) == 0 ||
+      (order = malloc(layout_window * sizeof(size_t))) == 0)
+    exit(-1);
+  for (;;) {
+    for (n = 0; n < layout_window && next_path(); n++) {
+      if ((win[n] = strdup(path)) == 0)
+        exit(-1);
+      offs[n] = in_off;
+      layout_key(path, &keys[n]);
+    }
+    if (!n)
+      break;
+    layout_order(keys, n, order);
+    own_path = path;
+    for (i = 0; i < n; i++) {
+      path = win[order[i]];
+      langs[order[i]] = path_langid();
+      lens[order[i]] = textlen;
+    }
+    path = own_path;
+    for (i = 0; i < n; i++) {
+      put_result(win[i], lens[i], langs[i]);
+      if (journal)
+        journal_tick(journal, offs[i], detectout);
+      free(win[i]);
+    }
+  }
+  free(win);
+  free(offs);
+  free(lens);
+  free(langs);
+  free(keys);
+  free(order);
+}
+
+void report_encodings() {
+  int e;
+  fprintf(stderr, "encodings:");
+  for (e = 0; e < NUM_ENCODINGS; ++e)
+    if (enc_docs[e])
+      fprintf(stderr, " %s %llu", encoding_name(e), enc_docs[e]);
+  fputc('\n', stderr);
+}
+
 unsigned filtered = 0, total = 0;
 char likely_enough(char const *lang, unsigned lang_index) {
   if (lang_index == (unsigned)-1)
@@ -157,14 +578,15 @@ char likely_enough(char const *lang, unsigned lang_index) {
   assert(lang);
   LikelyLanguage likely = langid_likely();
   normalize_logprobs_n(logprobs, lid->num_langs);
+  ssize_t len = field_flag ? fieldlen : textlen;
   double lpper = logprobs[lang_index];
-  if (textlen)
-    lpper /= textlen;
-  char enough = textlen &&
+  if (len > 0)
+    lpper /= len;
+  char enough = len > 0 &&
                 (likely.i == lang_index || (p_flag ? lpper >= min_logprob : 0));
   if (enough && verbose >= 1)
     fprintf(stderr, "%d %s %s=%.2f (/%d)\n", total, likely.lang, lang, lpper,
-            (unsigned)textlen);
+            (unsigned)len);
   else {
     ++filtered;
     char const *what = detok_flag ? dbuf : text;
@@ -176,9 +598,74 @@ char likely_enough(char const *lang, unsigned lang_index) {
   return enough;
 }
 
+/* -H over a mapped line file: a uniformly random byte offset picks the line
+ * containing it, so lines are drawn in proportion to their size */
+void sample_seek() {
+  char const *base = records->buf + records->pos;
+  size_t size = records->end - records->pos, at, start, end;
+  char delim = framing == FRAME_NUL ? 0 : '\n';
+  char const *q;
+  uint64_t rng = HIST_SEED;
+  madvise(records->buf, records->cap, MADV_RANDOM);
+  while (hist->n < HIST_MAX_SAMPLE) {
+    at = sample_below(&rng, size);
+    for (start = at; start && base[start - 1] != delim; --start)
+      ;
+    q = memchr(base + at, delim, size - at);
+    end = q ? (size_t)(q - base) + 1 : size;
+    /* line-mode identifies newline-terminated lines with the newline */
+    LangIndex i = identify_index(lid, base + start,
+                                 end - start - (q && delim != '\n'));
+    hist_add(hist, i, 1.0 / (end - start), 1);
+    if (hist->n % HIST_STEP == 0 && hist_halfwidth(hist) <= hist_eps)
+      break;
+  }
+  fprintf(stderr, "sampled %zu of ~%.0f %s by seeking, +-%.4f\n", hist->n,
+          size * hist->doc_w[hist->num_langs] / hist->n,
+          framing == FRAME_NUL ? "records" : "lines", hist_halfwidth(hist));
+}
+
+/* -H over a stream of lines or paths: a reservoir sample, identified in
+ * random order until it's precise enough */
+void sample_stream() {
+  Reservoir *r = open_reservoir(hist_sample_size(hist_eps), HIST_SEED);
+  size_t i, kept, missing = 0;
+  LangIndex li;
+  if (b_flag)
+    while (next_path())
+      reservoir_add(r, path, strlen(path), 0);
+  else
+    while (gotrecord())
+      reservoir_add(r, text, textlen, record_size());
+  shuffle_reservoir(r);
+  kept = r->n < r->k ? r->n : r->k;
+  for (i = 0; i < kept; ++i) {
+    if (!b_flag)
+      hist_add(hist, identify_index(lid, r->recs[i], r->lens[i]), 1,
+               r->sizes[i]);
+    else if (!map_doc(r->recs[i]))
+      ++missing;
+    else {
+      li = doc_index();
+      hist_add(hist, li, 1, textlen);
+      unmap_doc();
+    }
+    if (hist->n % HIST_STEP == 0 && hist_halfwidth(hist) <= hist_eps)
+      break;
+  }
+  fprintf(stderr, "sampled %zu of %zu %s, +-%.4f\n", hist->n, r->n,
+          b_flag ? "files" : "records", hist_halfwidth(hist));
+  if (missing)
+    fprintf(stderr, "%zu sampled files couldn't be opened\n", missing);
+  close_reservoir(r);
+}
+
 int main(int argc, char **argv) {
   opterr = 0;
 
+  if (argc > 1 && !strcmp(argv[1], "autotune"))
+    return autotune_main(argc - 1, argv + 1);
+
 #ifdef DEBUG
   fprintf(stderr, "DEBUG MODE ENABLED\n");
 #endif
@@ -243,6 +730,63 @@ int main(int argc, char **argv) {
     case 'l':
       l_flag = 1;
       break;
+    case '0':
+      framing = FRAME_NUL;
+      break;
+    case 'P':
+      framing = FRAME_LEN32;
+      break;
+    case 't':
+      tsv_col = atoi(optarg);
+      if (!tsv_col)
+        error("-t column numbers start at 1");
+      field_flag = 1;
+      break;
+    case 'J':
+      json_key = optarg;
+      field_flag = 1;
+      break;
+    case 'x':
+      fx = optarg;
+      break;
+    case 'V':
+      fV = optarg;
+      break;
+    case 'k':
+      fk = optarg;
+      break;
+    case 'R':
+      ring_name = optarg;
+      break;
+    case 'w':
+      workers = atoi(optarg);
+      break;
+    case 'E':
+      E_flag = 1;
+      if ((encoding = encoding_by_name(optarg)) == -1)
+        error("-E encodings are auto, utf-8, utf-16le, utf-16be, latin1 and "
+              "cp1252");
+      break;
+    case 'H':
+      hist_eps = strtod(optarg, NULL);
+      if (!(hist_eps > 0 && hist_eps < 0.5))
+        error("-H precision is in (0, 0.5)");
+      break;
+    case 'O':
+      if (!(layout_window = strtoul(optarg, NULL, 10)))
+        error("-O windows hold at least one path");
+      break;
+    case 'N':
+      neardup_threshold = strtod(optarg, NULL);
+      if (!(neardup_threshold > 0 && neardup_threshold <= 1))
+        error("-N similarity thresholds are in (0, 1]");
+      break;
+    case 's':
+    case 'S':
+      if (!parse_shard(optarg, &shard))
+        error("shards are given as i/N with 0 <= i < N");
+      shard.balanced = c == 'S';
+      break;
     case 'b':
       b_flag = 1;
       break;
@@ -266,6 +810,67 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Cannot specify both -l and -b.\n");
     exit(-1);
   }
+  if (field_flag && (b_flag || detok_flag)) {
+    fprintf(stderr, "-t and -J can't be combined with -b or -d.\n");
+    exit(-1);
+  }
+  if (fx && (g_flag || !(l_flag || field_flag))) {
+    fprintf(stderr, "-x requires line-mode (-l, -t or -J).\n");
+    exit(-1);
+  }
+  if (fV && g_flag) {
+    fprintf(stderr, "-V can't be combined with grep-mode.\n");
+    exit(-1);
+  }
+  if (fk && !(b_flag && fF)) {
+    fprintf(stderr, "-k requires batch-mode (-b) and an output file (-F).\n");
+    exit(-1);
+  }
+  if (framing != FRAME_NEWLINE && !(b_flag || (l_flag && !field_flag))) {
+    fprintf(stderr, "-0 and -P apply to -l and -b only.\n");
+    exit(-1);
+  }
+  if (framing != FRAME_NEWLINE && l_flag && (g_flag || detok_flag)) {
+    fprintf(stderr, "-0 and -P can't be combined with grep-mode or -d.\n");
+    exit(-1);
+  }
+  if (shard.n && !b_flag) {
+    fprintf(stderr, "-s and -S require batch-mode (-b).\n");
+    exit(-1);
+  }
+  if (fk && fV) {
+    fprintf(stderr, "-V output can't be resumed, so can't be used with -k.\n");
+    exit(-1);
+  }
+  if (neardup_threshold && (!b_flag || fV)) {
+    fprintf(stderr, "-N requires batch-mode (-b) and can't be combined "
+                    "with -V.\n");
+    exit(-1);
+  }
+  if (layout_window && (!b_flag || fV || hist_eps)) {
+    fprintf(stderr, "-O requires batch-mode (-b) and can't be combined with "
+                    "-V or -H.\n");
+    exit(-1);
+  }
+  if (encoding != ENC_UTF8 &&
+      (l_flag || field_flag || g_flag || ring_name || detok_flag)) {
+    fprintf(stderr, "-E applies to batch-mode and file-mode only.\n");
+    exit(-1);
+  }
+  if (hist_eps && (!(l_flag || b_flag) || g_flag || field_flag || fx ||
+                   fV || fk || neardup_threshold || detok_flag)) {
+    fprintf(stderr, "-H requires -l or -b and can't be combined with grep-mode, "
+                    "-t, -J, -d, -x, -V, -k or -N.\n");
+    exit(-1);
+  }
+  if (fk && compressed_path(fF)) {
+    fprintf(stderr, "-k can't resume a compressed -F output.\n");
+    exit(-1);
+  }
+  if (tsv_col && json_key) {
+    fprintf(stderr, "Cannot specify both -t and -J.\n");
+    exit(-1);
+  }
 
   /* enter appropriate operating mode.
    * we have an interactive mode determined by isatty, and then
@@ -274,7 +879,18 @@ int main(int argc, char **argv) {
 
   init();
 
-  if (g_flag) {
+  if (ring_name) {
+    if (serve_ring(ring_name, lid, workers, verbose >= 1 ? stderr : NULL))
+      exit(-1);
+  } else if (hist_eps) {
+    hist = open_hist(lid->num_langs);
+    if (l_flag && records && records->mapped && framing != FRAME_LEN32)
+      sample_seek();
+    else
+      sample_stream();
+    write_hist(hist, lid, detectout, b_flag ? "files" : "lines");
+    close_hist(hist);
+  } else if (g_flag) {
     while (gotline(detectin)) {
       ++total;
       if (likely_enough(en, en_index)) {
@@ -302,6 +918,24 @@ int main(int argc, char **argv) {
       } else if (in)
         gotline(in);
     }
+  } else if (field_flag) { /*line mode over one field of each record*/
+
+    while (gotline(detectin)) {
+      field_logprobs();
+      LikelyLanguage likely = likeliest(lid, logprobs);
+      if (fieldlen < 0)
+        likely.i = (LangIndex)-1, likely.lang = no_field;
+      put_record(likely.lang, detectout);
+      if (sidecar)
+        sidecar_add(sidecar, likely.i, textlen);
+      if (fvw)
+        fv_writer_add(fvw, lid->fv);
+    }
+    if (not_objects)
+      fprintf(stderr, "%lu lines weren't JSON objects; each was written as "
+                      "{\"langid\":\"%s\"}\n",
+              not_objects, no_field);
+
   } else if (isatty(fileno(detectin))) {
     printf("langid.c interactive mode.\n");
 
@@ -318,53 +952,75 @@ int main(int argc, char **argv) {
 
   } else if (l_flag) { /*line mode*/
 
-    while (gotline(detectin)) {
-      lang = langid();
-      printf("%s,%zd\n", lang, textlen);
+    while (gotrecord()) {
+      LangIndex i = identify_index(lid, text, textlen);
+      lang = get_lang_name(lid, i);
+      fprintf(detectout, "%s,%zd\n", lang, textlen);
+      if (sidecar)
+        sidecar_add(sidecar, i, record_size());
+      if (fvw)
+        fv_writer_add(fvw, text_fv());
     }
 
   } else if (b_flag) { /*batch mode*/
 
     /* loop on detectin, interpreting each line as a path */
-    while (gotline(detectin)) {
-      path[textlen - 1] = '\0';
-      /* TODO: ensure that path is a real file.
-       * the main issue is with directories I think, no problem reading from a
-       * pipe or socket presumably. Anything that returns data should be fair
-       * game.*/
-      if ((fd = open(path, O_RDONLY)) == -1) {
-        lang = no_file;
-      } else {
-        textlen = lseek(fd, 0, SEEK_END);
-        text = (char *)mmap(NULL, textlen, PROT_READ | PROT_WRITE, MAP_PRIVATE,
-                            fd, 0);
-        lang = langid();
-
-        /* no need to munmap if textlen is 0 */
-        if (textlen && (munmap(text, textlen) == -1)) {
-          fprintf(stderr, "failed to munmap %s of length %zd \n", path,
-                  textlen);
-          exit(-1);
-        }
-
-        close(fd);
+    if (layout_window)
+      batch_in_layout_order();
+    else
+      while (next_path()) {
+        path_langid();
+        put_result(path, textlen, lang);
+        if (journal)
+          journal_tick(journal, in_off, detectout);
       }
-      printf("%s,%zd,%s\n", path, textlen, lang);
+    if (journal)
+      close_journal(journal, in_off, detectout);
+    if (paths)
+      free_paths(paths);
+    close_records(records);
+    if (neardup) {
+      if (verbose >= 1)
+        fprintf(stderr,
+                "near-duplicates: %llu of %llu sketched documents reused a "
+                "label, %llu ambiguous, %u representatives\n",
+                (unsigned long long)neardup->reused,
+                (unsigned long long)neardup->docs,
+                (unsigned long long)neardup->ambiguous, neardup->num_reps);
+      close_neardup(neardup);
     }
+    if (encoding != ENC_UTF8 && verbose >= 1)
+      report_encodings();
 
   } else { /*file mode*/
 
     /* read all of detectin and process as a single file */
     textlen = getdelim(&text, &text_size, EOF, detectin);
-    lang = langid();
-    printf("%s,%zd\n", lang, textlen);
+    lang = doc_langid();
+    fprintf(detectout, "%s,%zd\n", lang, textlen);
+    if (encoding != ENC_UTF8 && verbose >= 1)
+      report_encodings();
+    if (fvw)
+      fv_writer_add(fvw, text_fv());
     free(text);
   }
 
+  Cost cost;
+  cost_start(&cost);
   destroy_identifier(lid);
+  if (verbose >= 2)
+    cost_report(&cost, "model teardown");
+  if (sidecar)
+    close_sidecar(sidecar);
+  if (fvw)
+    close_fv_writer(fvw);
   if (reject)
     fclose(reject);
   if (out)
     fclose(out);
+  if (fF && fclose(detectout)) {
+    fprintf(stderr, "ERROR: couldn't write '%s'\n", fF);
+    exit(-1);
+  }
   return 0;
 }
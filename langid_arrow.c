@@ -0,0 +1,174 @@
+/*
+ * Arrow C Data Interface import and export; see langid_arrow.h
+ */
+
+#include "langid_arrow.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* what an exported array owns */
+typedef struct {
+  const void* buffers[3];
+} Private;
+
+static void release_array(struct ArrowArray* a) {
+  Private* p = (Private*)a->private_data;
+  int64_t i;
+  if (a->dictionary) {
+    if (a->dictionary->release) a->dictionary->release(a->dictionary);
+    free(a->dictionary);
+  }
+  for (i = 0; i < a->n_buffers; i++) free((void*)p->buffers[i]);
+  free(p);
+  a->release = NULL;
+}
+
+static void release_schema(struct ArrowSchema* s) {
+  if (s->dictionary) {
+    if (s->dictionary->release) s->dictionary->release(s->dictionary);
+    free(s->dictionary);
+  }
+  s->release = NULL;
+}
+
+/* an array owning its n_buffers malloc'd buffers b[] (NULL ones allowed) */
+static void export_array(struct ArrowArray* a, int64_t length, int64_t null_count, int64_t n_buffers, void* b0,
+                         void* b1, void* b2) {
+  Private* p;
+  if ((p = (Private*)malloc(sizeof(Private))) == 0) exit(-1);
+  p->buffers[0] = b0;
+  p->buffers[1] = b1;
+  p->buffers[2] = b2;
+  memset(a, 0, sizeof(*a));
+  a->length = length;
+  a->null_count = null_count;
+  a->n_buffers = n_buffers;
+  a->buffers = p->buffers;
+  a->release = release_array;
+  a->private_data = p;
+}
+
+static void export_schema(struct ArrowSchema* s, char const* format, char const* name) {
+  memset(s, 0, sizeof(*s));
+  s->format = format;
+  s->name = name;
+  s->flags = ARROW_FLAG_NULLABLE;
+  s->release = release_schema;
+}
+
+/* the model's language codes as a string array */
+static void export_languages(LanguageIdentifier* lid, struct ArrowArray* a) {
+  unsigned i, n = lid->num_langs;
+  int32_t* offsets;
+  char* data;
+  size_t size = 0;
+  for (i = 0; i < n; i++) size += strlen(get_lang_name(lid, i));
+  if ((offsets = (int32_t*)malloc((n + 1) * sizeof(int32_t))) == 0) exit(-1);
+  if ((data = (char*)malloc(size ? size : 1)) == 0) exit(-1);
+  for (offsets[0] = 0, i = 0; i < n; i++) {
+    size_t len = strlen(get_lang_name(lid, i));
+    memcpy(data + offsets[i], get_lang_name(lid, i), len);
+    offsets[i + 1] = offsets[i] + len;
+  }
+  export_array(a, n, 0, 3, NULL, offsets, data);
+}
+
+/* bits offset..offset+n of a validity bitmap, starting at bit 0 */
+static uint8_t* copy_validity(uint8_t const* bits, int64_t offset, int64_t n) {
+  size_t bytes = (n + 7) / 8;
+  uint8_t* out;
+  int64_t i;
+  if (!bits) return NULL;
+  if ((out = (uint8_t*)calloc(bytes ? bytes : 1, 1)) == 0) exit(-1);
+  if (!(offset & 7))
+    memcpy(out, bits + offset / 8, bytes);
+  else
+    for (i = 0; i < n; i++)
+      if (bits[(offset + i) >> 3] >> ((offset + i) & 7) & 1) out[i >> 3] |= 1 << (i & 7);
+  return out;
+}
+
+int langid_arrow_identify(LanguageIdentifier* lid, LangidPool* pool, struct ArrowSchema const* schema,
+                          struct ArrowArray const* array, struct ArrowSchema* lang_schema,
+                          struct ArrowArray* langs, struct ArrowSchema* score_schema,
+                          struct ArrowArray* scores) {
+  char const* f = schema ? schema->format : NULL;
+  int large;
+  int64_t i, n, off;
+  uint8_t const* bits;
+  int32_t const* off32;
+  int64_t const* off64;
+  char const* data;
+  LangIndex* index;
+  float* score = NULL;
+  double logprobs[lid->num_langs], sum;
+  unsigned j;
+
+  if (!f || !array || !array->release || (f[0] != 'u' && f[0] != 'U' && f[0] != 'z' && f[0] != 'Z') || f[1] ||
+      array->n_buffers != 3 || array->length < 0)
+    return EINVAL;
+  large = f[0] == 'U' || f[0] == 'Z';
+  n = array->length;
+  off = array->offset;
+  /* null_count -1 is unknown */
+  bits = array->null_count ? (uint8_t const*)array->buffers[0] : NULL;
+  off32 = (int32_t const*)array->buffers[1] + off;
+  off64 = (int64_t const*)array->buffers[1] + off;
+  data = (char const*)array->buffers[2];
+  /* identify takes unsigned lengths */
+  if (large)
+    for (i = 0; i < n; i++)
+      if (off64[i + 1] - off64[i] > UINT_MAX) return EINVAL;
+  if (pool && !scores && (uint64_t)n > UINT_MAX) return EINVAL;
+
+  if ((index = (LangIndex*)malloc((n ? n : 1) * sizeof(LangIndex))) == 0) exit(-1);
+  if (scores && (score = (float*)malloc((n ? n : 1) * sizeof(float))) == 0) exit(-1);
+#define ROW(i) (data + (large ? off64[i] : off32[i]))
+#define ROW_LEN(i) (unsigned)(large ? off64[(i) + 1] - off64[i] : off32[(i) + 1] - off32[i])
+#define IS_NULL(i) (bits && !(bits[(off + (i)) >> 3] >> ((off + (i)) & 7) & 1))
+  if (pool && !scores) {
+    char const** docs;
+    unsigned* lens;
+    if ((docs = (char const**)malloc((n ? n : 1) * sizeof(char const*))) == 0) exit(-1);
+    if ((lens = (unsigned*)malloc((n ? n : 1) * sizeof(unsigned))) == 0) exit(-1);
+    for (i = 0; i < n; i++) {
+      docs[i] = ROW(i);
+      lens[i] = IS_NULL(i) ? 0 : ROW_LEN(i);
+    }
+    pool_identify(pool, docs, lens, n, index);
+    free(docs);
+    free(lens);
+  } else
+    for (i = 0; i < n; i++) {
+      if (IS_NULL(i)) {
+        index[i] = 0;
+        if (score) score[i] = 0;
+      } else if (!score)
+        index[i] = identify_index(lid, ROW(i), ROW_LEN(i));
+      else {
+        identify_logprobs(lid, ROW(i), ROW_LEN(i), logprobs);
+        index[i] = logprob_to_pred(lid, logprobs);
+        for (sum = 0, j = 0; j < lid->num_langs; j++) sum += exp(logprobs[j] - logprobs[index[i]]);
+        score[i] = 1 / sum;
+      }
+    }
+#undef ROW
+#undef ROW_LEN
+#undef IS_NULL
+
+  export_array(langs, n, bits ? array->null_count : 0, 2, copy_validity(bits, off, n), index, NULL);
+  if ((langs->dictionary = (struct ArrowArray*)malloc(sizeof(struct ArrowArray))) == 0) exit(-1);
+  export_languages(lid, langs->dictionary);
+  export_schema(lang_schema, "i", "lang");
+  if ((lang_schema->dictionary = (struct ArrowSchema*)malloc(sizeof(struct ArrowSchema))) == 0) exit(-1);
+  export_schema(lang_schema->dictionary, "u", "");
+  lang_schema->dictionary->flags = 0;
+  if (scores) {
+    export_array(scores, n, bits ? array->null_count : 0, 2, copy_validity(bits, off, n), score, NULL);
+    export_schema(score_schema, "f", "score");
+  }
+  return 0;
+}
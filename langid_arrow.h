@@ -0,0 +1,63 @@
+#ifndef _LANGID_ARROW_H
+#define _LANGID_ARROW_H
+
+#include "batch.h"
+#include "liblangid.h"
+#include <stdint.h>
+
+/* Apache Arrow C Data Interface binding: identify a string column in place
+ * and hand back Arrow arrays, without linking any Arrow library. The
+ * structs are the ABI the spec asks consumers to copy verbatim.
+ */
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif
+
+/** identify every row of a string (format "u"), large string ("U"),
+    binary ("z") or large binary ("Z") array, reading its buffers in place.
+    langs gets a dictionary-encoded column: int32 indices (the LangIndex)
+    into a string dictionary of all the model's language codes. If scores
+    isn't NULL, it gets a float32 column of each row's language probability.
+    Null rows are null in both. The outputs are owned by the caller and
+    freed through their release callbacks; input and lid must outlive the
+    call only. With a pool (and no scores), the rows are identified on its
+    threads.
+    Returns 0, or EINVAL for an unsupported input (leaving the outputs
+    untouched). */
+extern int langid_arrow_identify(LanguageIdentifier* lid, LangidPool* pool, struct ArrowSchema const* schema,
+                                 struct ArrowArray const* array, struct ArrowSchema* lang_schema,
+                                 struct ArrowArray* langs, struct ArrowSchema* score_schema,
+                                 struct ArrowArray* scores);
+
+#endif
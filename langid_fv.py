@@ -0,0 +1,47 @@
+"""
+Load the per-document feature vectors written by `langid -V` as a
+scipy.sparse.csr_matrix whose arrays are views of an mmap of the file, so
+nothing is copied (as long as the file's nnz < 2**31 and its indptr is
+int32; otherwise scipy upcasts indices to int64).
+
+  import langid_fv
+  X = langid_fv.load('docs.fv')   # shape (num_docs, num_feats)
+"""
+
+import struct
+import numpy as np
+import scipy.sparse
+
+MAGIC = b'LIDF'
+VERSION = 1
+HEADER = struct.Struct('<4sIII6Q')
+
+
+def load_arrays(path):
+  """
+  Return (data, indices, indptr, shape) as read-only numpy views of the file.
+  """
+  buf = np.memmap(path, dtype=np.uint8, mode='r')
+  magic, version, num_feats, indptr_size, num_docs, nnz, indices_offset, \
+      data_offset, indptr_offset, _ = HEADER.unpack_from(buf, 0)
+  if magic != MAGIC or version != VERSION:
+    raise ValueError("{0} is not a langid feature vector file".format(path))
+  indptr_dtype = '<i4' if indptr_size == 4 else '<i8'
+  indices = np.frombuffer(buf, dtype='<i4', count=nnz, offset=indices_offset)
+  data = np.frombuffer(buf, dtype='<u4', count=nnz, offset=data_offset)
+  indptr = np.frombuffer(buf, dtype=indptr_dtype, count=num_docs + 1, offset=indptr_offset)
+  return data, indices, indptr, (num_docs, num_feats)
+
+
+def load(path):
+  data, indices, indptr, shape = load_arrays(path)
+  X = scipy.sparse.csr_matrix((data, indices, indptr), shape=shape, copy=False)
+  X.has_sorted_indices = True
+  return X
+
+
+if __name__ == "__main__":
+  import sys
+  for path in sys.argv[1:]:
+    X = load(path)
+    print("{0}: {1} docs x {2} feats, {3} nonzero".format(path, X.shape[0], X.shape[1], X.nnz))
@@ -0,0 +1,211 @@
+/*
+ * JNI binding to liblangid, for the Java class langid.LangId
+ * (java/src/main/java/langid/LangId.java).
+ *
+ * Text is read in place: from direct ByteBuffers via their address, and
+ * from byte[] via GetPrimitiveArrayCritical, which pins rather than copies
+ * on HotSpot. As a pinned array holds off the GC for every thread, batches
+ * pin the text one document at a time, and copy the offsets and results
+ * in and out instead of pinning them. Each thread scores with its own
+ * clone_identifier of the model, created on first use and kept in
+ * thread-specific data.
+ */
+#include <jni.h>
+#include "liblangid.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct Scratch Scratch;
+
+typedef struct {
+  LanguageIdentifier* lid;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  Scratch* scratch; /* all clones, so close can free them */
+} Model;
+
+struct Scratch {
+  Model* model;
+  LanguageIdentifier* lid;
+  Scratch *prev, *next;
+};
+
+static void unlink_scratch(Scratch* s) {
+  Model* m = s->model;
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    m->scratch = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+/* thread exit */
+static void destroy_scratch(void* p) {
+  Scratch* s = (Scratch*)p;
+  Model* m = s->model;
+  pthread_mutex_lock(&m->lock);
+  unlink_scratch(s);
+  pthread_mutex_unlock(&m->lock);
+  destroy_identifier(s->lid);
+  free(s);
+}
+
+static LanguageIdentifier* thread_identifier(Model* m) {
+  Scratch* s = (Scratch*)pthread_getspecific(m->key);
+  if (s) return s->lid;
+  if ((s = (Scratch*)malloc(sizeof(Scratch))) == 0) exit(-1);
+  s->model = m;
+  s->lid = clone_identifier(m->lid);
+  s->prev = NULL;
+  pthread_mutex_lock(&m->lock);
+  if ((s->next = m->scratch)) s->next->prev = s;
+  m->scratch = s;
+  pthread_mutex_unlock(&m->lock);
+  pthread_setspecific(m->key, s);
+  return s->lid;
+}
+
+static void throw_new(JNIEnv* env, char const* cls, char const* msg) {
+  jclass c = (*env)->FindClass(env, cls);
+  if (c) (*env)->ThrowNew(env, c, msg);
+}
+
+JNIEXPORT jlong JNICALL Java_langid_LangId_load(JNIEnv* env, jclass cls, jstring path) {
+  Model* m;
+  if ((m = (Model*)malloc(sizeof(Model))) == 0) {
+    throw_new(env, "java/lang/OutOfMemoryError", "langid model");
+    return 0;
+  }
+  if (path) {
+    char const* p = (*env)->GetStringUTFChars(env, path, NULL);
+    if (!p) return 0;
+    /* load_identifier exits on failure, so catch the common case first */
+    if (access(p, R_OK)) {
+      (*env)->ReleaseStringUTFChars(env, path, p);
+      free(m);
+      throw_new(env, "java/io/FileNotFoundException", "langid model not readable");
+      return 0;
+    }
+    m->lid = load_identifier(p);
+    (*env)->ReleaseStringUTFChars(env, path, p);
+  } else
+    m->lid = get_default_identifier();
+  pthread_key_create(&m->key, destroy_scratch);
+  pthread_mutex_init(&m->lock, NULL);
+  m->scratch = NULL;
+  return (jlong)(intptr_t)m;
+}
+
+JNIEXPORT void JNICALL Java_langid_LangId_free(JNIEnv* env, jclass cls, jlong h) {
+  Model* m = (Model*)(intptr_t)h;
+  Scratch *s, *next;
+  /* no thread may be using the model any more, so their clones can go */
+  pthread_key_delete(m->key);
+  for (s = m->scratch; s; s = next) {
+    next = s->next;
+    destroy_identifier(s->lid);
+    free(s);
+  }
+  pthread_mutex_destroy(&m->lock);
+  destroy_identifier(m->lid);
+  free(m);
+}
+
+JNIEXPORT jobjectArray JNICALL Java_langid_LangId_languages(JNIEnv* env, jclass cls, jlong h) {
+  Model* m = (Model*)(intptr_t)h;
+  jobjectArray names;
+  unsigned i;
+  jclass string = (*env)->FindClass(env, "java/lang/String");
+  if (!string || !(names = (*env)->NewObjectArray(env, m->lid->num_langs, string, NULL))) return NULL;
+  for (i = 0; i < m->lid->num_langs; i++) {
+    jstring name = (*env)->NewStringUTF(env, get_lang_name(m->lid, i));
+    if (!name) return NULL;
+    (*env)->SetObjectArrayElement(env, names, i, name);
+    (*env)->DeleteLocalRef(env, name);
+  }
+  return names;
+}
+
+JNIEXPORT jint JNICALL Java_langid_LangId_identifyDirect(JNIEnv* env, jclass cls, jlong h, jobject buf, jint off,
+                                                         jint len) {
+  char const* p = (char const*)(*env)->GetDirectBufferAddress(env, buf);
+  if (!p) {
+    throw_new(env, "java/lang/IllegalArgumentException", "not a direct ByteBuffer");
+    return -1;
+  }
+  return identify_index(thread_identifier((Model*)(intptr_t)h), p + off, len);
+}
+
+JNIEXPORT jint JNICALL Java_langid_LangId_identifyArray(JNIEnv* env, jclass cls, jlong h, jbyteArray a, jint off,
+                                                        jint len) {
+  LanguageIdentifier* lid = thread_identifier((Model*)(intptr_t)h);
+  LangIndex r;
+  char* p = (char*)(*env)->GetPrimitiveArrayCritical(env, a, NULL);
+  if (!p) return -1;
+  r = identify_index(lid, p + off, len);
+  (*env)->ReleasePrimitiveArrayCritical(env, a, p, JNI_ABORT);
+  return r;
+}
+
+/* a copy of offsets[0..n], followed by room for n results, after checking
+ * the documents text[offsets[i] .. offsets[i+1]) are within size bytes
+ * (again: another thread may have changed offsets since LangId did); NULL,
+ * with an exception pending, on failure. free it */
+static jint* batch_offsets(JNIEnv* env, jintArray offsets, jint n, jlong size) {
+  jint* o;
+  jint i;
+  if ((o = (jint*)malloc((2 * (size_t)n + 1) * sizeof(jint))) == 0) {
+    throw_new(env, "java/lang/OutOfMemoryError", "langid batch");
+    return NULL;
+  }
+  (*env)->GetIntArrayRegion(env, offsets, 0, n + 1, o);
+  if ((*env)->ExceptionCheck(env)) {
+    free(o);
+    return NULL;
+  }
+  for (i = 0; i < n && o[i] >= 0 && o[i] <= o[i + 1]; i++)
+    ;
+  if (i < n || o[n] > size) {
+    free(o);
+    throw_new(env, "java/lang/IndexOutOfBoundsException", "langid batch offsets");
+    return NULL;
+  }
+  return o;
+}
+
+JNIEXPORT void JNICALL Java_langid_LangId_identifyBatchDirect(JNIEnv* env, jclass cls, jlong h, jobject buf,
+                                                              jintArray offsets, jint n, jintArray results) {
+  LanguageIdentifier* lid = thread_identifier((Model*)(intptr_t)h);
+  char const* p = (char const*)(*env)->GetDirectBufferAddress(env, buf);
+  jint *o, *r, i;
+  if (!p) {
+    throw_new(env, "java/lang/IllegalArgumentException", "not a direct ByteBuffer");
+    return;
+  }
+  if (!(o = batch_offsets(env, offsets, n, (*env)->GetDirectBufferCapacity(env, buf)))) return;
+  r = o + n + 1;
+  for (i = 0; i < n; i++) r[i] = identify_index(lid, p + o[i], o[i + 1] - o[i]);
+  (*env)->SetIntArrayRegion(env, results, 0, n, r);
+  free(o);
+}
+
+JNIEXPORT void JNICALL Java_langid_LangId_identifyBatchArray(JNIEnv* env, jclass cls, jlong h, jbyteArray text,
+                                                             jintArray offsets, jint n, jintArray results) {
+  LanguageIdentifier* lid = thread_identifier((Model*)(intptr_t)h);
+  char* p;
+  jint *o, *r, i;
+  if (!(o = batch_offsets(env, offsets, n, (*env)->GetArrayLength(env, text)))) return;
+  r = o + n + 1;
+  /* pinned for one document at a time, so a batch doesn't hold off the GC */
+  for (i = 0; i < n; i++) {
+    if (!(p = (char*)(*env)->GetPrimitiveArrayCritical(env, text, NULL))) {
+      free(o);
+      return;
+    }
+    r[i] = identify_index(lid, p + o[i], o[i + 1] - o[i]);
+    (*env)->ReleasePrimitiveArrayCritical(env, text, p, JNI_ABORT);
+  }
+  (*env)->SetIntArrayRegion(env, results, 0, n, r);
+  free(o);
+}
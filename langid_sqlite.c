@@ -0,0 +1,171 @@
+/*
+ * SQLite loadable extension: .load ./langid_sqlite (or load_extension()).
+ *
+ *   langid(text)              language code, e.g. 'en'
+ *   langid_score(text, lang)  probability of lang (0..1) under the model
+ *   langid_hist(text)         aggregate: '{"en":123,"de":45}' by decreasing
+ *                             count
+ *
+ * NULL text gives NULL (and isn't counted by langid_hist); BLOBs are taken
+ * as UTF-8 bytes. All connections in a process share one model - the
+ * built-in one, or $LANGID_MODEL - and each connection scores with its own
+ * clone_identifier, reused across rows. SQLite never runs one connection's
+ * functions on two threads at once, so the clone needs no locking.
+ */
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+#include "liblangid.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef SQLITE_INNOCUOUS
+#define SQLITE_INNOCUOUS 0
+#endif
+
+static LanguageIdentifier* model;
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the functions one connection registers, sharing a Conn */
+#define NUM_FUNCTIONS 3
+
+typedef struct {
+  LanguageIdentifier* lid;
+  double* logprobs;
+  int refs; /* registered functions not yet destroyed */
+} Conn;
+
+static void free_conn(Conn* c) {
+  destroy_identifier(c->lid);
+  free(c->logprobs);
+  free(c);
+}
+
+static void release_conn(void* p) {
+  Conn* c = (Conn*)p;
+  if (!--c->refs) free_conn(c);
+}
+
+/* the bytes of a text or blob argument; NULL for SQL NULL */
+static char const* arg_text(sqlite3_value* v, unsigned* len) {
+  char const* t;
+  switch (sqlite3_value_type(v)) {
+    case SQLITE_NULL: return NULL;
+    case SQLITE_BLOB: t = (char const*)sqlite3_value_blob(v); break;
+    default: t = (char const*)sqlite3_value_text(v);
+  }
+  *len = sqlite3_value_bytes(v);
+  return t ? t : "";
+}
+
+static void langid_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  Conn* c = (Conn*)sqlite3_user_data(ctx);
+  unsigned len;
+  char const* t = arg_text(argv[0], &len);
+  if (!t) return;
+  sqlite3_result_text(ctx, get_lang_name(c->lid, identify_index(c->lid, t, len)), -1, SQLITE_STATIC);
+}
+
+static void langid_score_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  Conn* c = (Conn*)sqlite3_user_data(ctx);
+  unsigned len, i, n = c->lid->num_langs;
+  char const* t = arg_text(argv[0], &len);
+  char const* lang = (char const*)sqlite3_value_text(argv[1]);
+  LangIndex li;
+  double sum = 0;
+  if (!t || !lang) return;
+  if ((li = get_lang_index(c->lid, lang)) == (LangIndex)-1) {
+    sqlite3_result_error(ctx, "langid_score: language not in the model", -1);
+    return;
+  }
+  identify_logprobs(c->lid, t, len, c->logprobs);
+  for (i = 0; i < n; i++) sum += exp(c->logprobs[i] - c->logprobs[li]);
+  sqlite3_result_double(ctx, 1 / sum);
+}
+
+static void langid_hist_step(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  Conn* c = (Conn*)sqlite3_user_data(ctx);
+  unsigned len;
+  char const* t = arg_text(argv[0], &len);
+  sqlite3_int64* counts;
+  if (!t) return;
+  if (!(counts = (sqlite3_int64*)sqlite3_aggregate_context(ctx, c->lid->num_langs * sizeof(sqlite3_int64)))) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  ++counts[identify_index(c->lid, t, len)];
+}
+
+static void langid_hist_final(sqlite3_context* ctx) {
+  Conn* c = (Conn*)sqlite3_user_data(ctx);
+  sqlite3_int64* counts = (sqlite3_int64*)sqlite3_aggregate_context(ctx, 0);
+  unsigned i, j, x, n = c->lid->num_langs, order[n];
+  sqlite3_str* s = sqlite3_str_new(NULL);
+  sqlite3_str_appendchar(s, 1, '{');
+  if (counts) {
+    /* insertion sort by decreasing count: there are only num_langs */
+    for (i = 0; i < n; i++) {
+      for (x = i, j = i; j && counts[order[j - 1]] < counts[x]; j--) order[j] = order[j - 1];
+      order[j] = x;
+    }
+    for (i = 0; i < n && counts[order[i]]; i++)
+      sqlite3_str_appendf(s, "%s\"%s\":%lld", i ? "," : "", get_lang_name(c->lid, order[i]), counts[order[i]]);
+  }
+  sqlite3_str_appendchar(s, 1, '}');
+  sqlite3_result_text(ctx, sqlite3_str_finish(s), -1, sqlite3_free);
+}
+
+static struct {
+  char const* name;
+  int nargs;
+  void (*func)(sqlite3_context*, int, sqlite3_value**);
+  void (*step)(sqlite3_context*, int, sqlite3_value**);
+  void (*final)(sqlite3_context*);
+} const functions[NUM_FUNCTIONS] = {
+    {"langid", 1, langid_func, 0, 0},
+    {"langid_score", 2, langid_score_func, 0, 0},
+    {"langid_hist", 1, 0, langid_hist_step, langid_hist_final},
+};
+
+/* the shared model, loaded by the first connection */
+static LanguageIdentifier* shared_model(char** err) {
+  char const* path = getenv("LANGID_MODEL");
+  pthread_mutex_lock(&model_lock);
+  if (!model) {
+    /* load_identifier exits on failure, so catch the common case first */
+    if (path && *path && access(path, R_OK))
+      *err = sqlite3_mprintf("langid: can't read LANGID_MODEL %s", path);
+    else
+      model = path && *path ? load_identifier(path) : get_default_identifier();
+  }
+  pthread_mutex_unlock(&model_lock);
+  return model;
+}
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_langidsqlite_init(sqlite3* db, char** err, sqlite3_api_routines const* api) {
+  int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, rc;
+  unsigned i;
+  LanguageIdentifier* m;
+  Conn* c;
+  SQLITE_EXTENSION_INIT2(api);
+  if (!(m = shared_model(err))) return SQLITE_ERROR;
+  if (!(c = (Conn*)malloc(sizeof(Conn)))) return SQLITE_NOMEM;
+  if (!(c->logprobs = (double*)malloc(m->num_langs * sizeof(double)))) {
+    free(c);
+    return SQLITE_NOMEM;
+  }
+  c->lid = clone_identifier(m);
+  c->refs = NUM_FUNCTIONS;
+  for (i = 0; i < NUM_FUNCTIONS; i++)
+    if ((rc = sqlite3_create_function_v2(db, functions[i].name, functions[i].nargs, flags, c, functions[i].func,
+                                         functions[i].step, functions[i].final, release_conn))) {
+      /* SQLite released function i's reference; later ones were never made */
+      if (!(c->refs -= NUM_FUNCTIONS - i - 1)) free_conn(c);
+      return rc;
+    }
+  return SQLITE_OK;
+}
@@ -0,0 +1,176 @@
+/*
+ * Merge the outputs of sharded batch runs (langid -b -s/-S i/N) back into
+ * one result in path-list order, and summarize it per language.
+ */
+
+#define _GNU_SOURCE /* memrchr */
+#include "records.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char const *getoptspec = "hp:o:y:0P";
+
+void usage() {
+  printf("langidmerge -p paths [-0|-P] [-o out] [-y summary] shard-output... (%s)\n"
+         "\n -p: the path list the shards were given"
+         "\n -0: the path list and shard outputs are NUL-terminated (langid -0)"
+         "\n -P: they are length-prefixed (langid -P)"
+         "\n -o: merged output (default stdout)"
+         "\n -y: write per-language documents and bytes here (default stderr)"
+         "\n shard outputs may be given in any order"
+         "\n\n",
+         getoptspec);
+}
+
+void error(char const *msg) {
+  fprintf(stderr, "%s\n", msg);
+  exit(-1);
+}
+
+FILE *openfile(char const *name, char const *mode) {
+  FILE *r = fopen(name, mode);
+  if (r)
+    return r;
+  fprintf(stderr, "ERROR: couldn't open '%s'\n", name);
+  exit(-1);
+}
+
+int framing = FRAME_NEWLINE;
+
+typedef struct {
+  RecordReader *r;
+  char const *line;
+  size_t len;
+  int done;
+} ShardOutput;
+
+void advance(ShardOutput *s) { s->done = !next_record(s->r, &s->line, &s->len); }
+
+/* does the batch-mode result s->line describe path? */
+int is_for(ShardOutput *s, char const *path, size_t pathlen) {
+  return !s->done && s->len > pathlen && s->line[pathlen] == ',' &&
+         !memcmp(s->line, path, pathlen);
+}
+
+typedef struct {
+  char *lang;
+  unsigned long long docs, bytes;
+} LangStats;
+
+LangStats *stats = NULL;
+unsigned num_stats = 0;
+
+/* results are path,length,lang - and path may itself contain commas */
+void count(char const *line, size_t len) {
+  char const *lang, *bytes;
+  size_t langlen;
+  unsigned i;
+  if (!(lang = memrchr(line, ',', len)))
+    return;
+  langlen = line + len - ++lang;
+  bytes = memrchr(line, ',', lang - 1 - line);
+  for (i = 0; i < num_stats; i++)
+    if (strlen(stats[i].lang) == langlen && !memcmp(stats[i].lang, lang, langlen))
+      break;
+  if (i == num_stats) {
+    if ((stats = realloc(stats, ++num_stats * sizeof(LangStats))) == 0)
+      exit(-1);
+    if ((stats[i].lang = strndup(lang, langlen)) == 0)
+      exit(-1);
+    stats[i].docs = stats[i].bytes = 0;
+  }
+  ++stats[i].docs;
+  stats[i].bytes += bytes ? strtoull(bytes + 1, NULL, 10) : 0;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  char *fp = NULL, *fo = NULL, *fy = NULL;
+  char const *path;
+  size_t pathlen;
+  unsigned i, n, hint = 0;
+  unsigned long long docs = 0, bytes = 0;
+  FILE *out = stdout, *summary = stderr;
+  RecordReader *pin;
+  ShardOutput *shards;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'h':
+      usage();
+      return 0;
+    case 'p':
+      fp = optarg;
+      break;
+    case 'o':
+      fo = optarg;
+      break;
+    case 'y':
+      fy = optarg;
+      break;
+    case '0':
+      framing = FRAME_NUL;
+      break;
+    case 'P':
+      framing = FRAME_LEN32;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  if (!fp || optind == argc)
+    error("need -p paths and at least one shard output");
+
+  pin = open_records(openfile(fp, "r"), framing);
+  if (fo)
+    out = openfile(fo, "w");
+  n = argc - optind;
+  if ((shards = calloc(n, sizeof(ShardOutput))) == 0)
+    exit(-1);
+  for (i = 0; i < n; i++) {
+    shards[i].r = open_records(openfile(argv[optind + i], "r"), framing);
+    advance(&shards[i]);
+  }
+
+  /* every shard output is in path-list order, so the next path's result is
+   * at the head of one of them. try the shard that last matched first: with
+   * -S shards, consecutive paths often share one */
+  while (next_record(pin, &path, &pathlen)) {
+    if (!is_for(&shards[hint], path, pathlen)) {
+      for (i = 0; i < n && !is_for(&shards[i], path, pathlen); i++)
+        ;
+      if (i == n) {
+        fprintf(stderr, "ERROR: no shard output has '%.*s' next\n",
+                (int)pathlen, path);
+        exit(-1);
+      }
+      hint = i;
+    }
+    write_record(out, framing, shards[hint].line, shards[hint].len);
+    count(shards[hint].line, shards[hint].len);
+    advance(&shards[hint]);
+  }
+  for (i = 0; i < n; i++)
+    if (!shards[i].done) {
+      fprintf(stderr, "ERROR: %s has results for paths not in %s\n",
+              argv[optind + i], fp);
+      exit(-1);
+    }
+  if (fclose(out))
+    error("error writing merged output");
+
+  if (fy)
+    summary = openfile(fy, "w");
+  for (i = 0; i < num_stats; i++) {
+    docs += stats[i].docs;
+    bytes += stats[i].bytes;
+  }
+  fprintf(summary, "lang\tdocs\tbytes\n");
+  for (i = 0; i < num_stats; i++)
+    fprintf(summary, "%s\t%llu\t%llu\n", stats[i].lang, stats[i].docs,
+            stats[i].bytes);
+  fprintf(summary, "total\t%llu\t%llu\n", docs, bytes);
+  return 0;
+}
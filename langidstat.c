@@ -0,0 +1,266 @@
+/*
+ * Print statistics of a model - the in-built one or a protobuf model - to
+ * guide pruning and layout choices: the size of each section, DFA fan-out
+ * and reachability, the range and entropy of the naive Bayes weights, and
+ * each language's feature coverage.
+ */
+
+#include "hashfv.h"
+#include "liblangid.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char const *getoptspec = "hm:";
+
+void usage() {
+  printf("langidstat [-m model] (%s)\n"
+         "\n -m: protobuf model file (default: the in-built model)"
+         "\n\n",
+         getoptspec);
+}
+
+LanguageIdentifier *lid;
+
+static int cmp_double(void const *a, void const *b) {
+  double x = *(double const *)a, y = *(double const *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* sorts v */
+static void print_summary(char const *what, double *v, size_t n) {
+  double sum = 0;
+  size_t i;
+  if (!n) {
+    printf("  %-28s (none)\n", what);
+    return;
+  }
+  qsort(v, n, sizeof(double), cmp_double);
+  for (i = 0; i < n; i++)
+    sum += v[i];
+  printf("  %-28s min %-10.4g p50 %-10.4g p90 %-10.4g p99 %-10.4g max "
+         "%-10.4g mean %.4g\n",
+         what, v[0], v[n / 2], v[n * 9 / 10], v[n * 99 / 100], v[n - 1],
+         sum / n);
+}
+
+static void print_size(char const *what, size_t bytes) {
+  printf("  %-28s %12zu bytes (%.1f MB)\n", what, bytes, bytes / 1048576.0);
+}
+
+/* states reachable from the start by bytes < limit */
+static unsigned reachable(unsigned limit) {
+  unsigned *queue, i, j, b, s, t, n = lid->num_states;
+  char *seen;
+  if ((queue = (unsigned *)malloc(n * sizeof(unsigned))) == 0)
+    exit(-1);
+  if ((seen = (char *)calloc(n, 1)) == 0)
+    exit(-1);
+  seen[0] = 1;
+  queue[0] = 0;
+  for (i = 0, j = 1; i < j; i++) {
+    s = queue[i];
+    for (b = 0; b < limit; b++)
+      if (!seen[t = TK_STATE((*lid->tk_nextmove)[s][b])]) {
+        seen[t] = 1;
+        queue[j++] = t;
+      }
+  }
+  free(queue);
+  free(seen);
+  return j;
+}
+
+static void dfa_stats(void) {
+  unsigned n = lid->num_states, s, b, t, max_out = 0, *stamp, *hist,
+           emitting = 0;
+  size_t outputs = 0;
+  double *v;
+
+  if ((stamp = (unsigned *)calloc(n, sizeof(unsigned))) == 0)
+    exit(-1);
+  if ((v = (double *)malloc(n * sizeof(double))) == 0)
+    exit(-1);
+  for (s = 0; s < n; s++) {
+    outputs += (*lid->tk_output_c)[s];
+    if ((*lid->tk_output_c)[s] > max_out)
+      max_out = (*lid->tk_output_c)[s];
+    emitting += (*lid->tk_output_c)[s] != 0;
+  }
+
+  printf("\nDFA\n");
+  printf("  states                       %u (%u complete features, %zu outputs)\n",
+         n, emitting, outputs);
+  printf("  reachable                    %u; by ASCII bytes alone %u\n",
+         reachable(256), reachable(128));
+
+  /* distinct successors of each state */
+  for (s = 0; s < n; s++) {
+    unsigned distinct = 0;
+    for (b = 0; b < 256; b++)
+      if (stamp[t = TK_STATE((*lid->tk_nextmove)[s][b])] != s + 1) {
+        stamp[t] = s + 1;
+        distinct++;
+      }
+    v[s] = distinct;
+  }
+  print_summary("distinct successors", v, n);
+  for (s = 0; s < n; s++) {
+    unsigned to_start = 0;
+    for (b = 0; b < 256; b++)
+      to_start += TK_STATE((*lid->tk_nextmove)[s][b]) == 0;
+    v[s] = to_start;
+  }
+  print_summary("moves back to the start", v, n);
+
+  /* features completed per state (tk_output_c) */
+  if ((hist = (unsigned *)calloc(max_out + 1, sizeof(unsigned))) == 0)
+    exit(-1);
+  for (s = 0; s < n; s++)
+    hist[(*lid->tk_output_c)[s]]++;
+  printf("  outputs per state           ");
+  for (t = 0; t <= max_out; t++)
+    if (hist[t])
+      printf(" %u:%u", t, hist[t]);
+  printf("\n");
+
+  free(hist);
+  free(stamp);
+  free(v);
+}
+
+static void weight_stats(void) {
+  unsigned F = lid->num_feats, L = lid->num_langs, f, l, uniform = 0;
+  double *w = *lid->nb_ptc, *v, *range, lo = INFINITY, hi = -INFINITY;
+  double max_h = log2(L), m, z, h, p;
+
+  if ((v = (double *)malloc(F * sizeof(double))) == 0)
+    exit(-1);
+  if ((range = (double *)malloc(F * sizeof(double))) == 0)
+    exit(-1);
+  for (f = 0; f < F; f++) {
+    double flo = INFINITY, fhi = -INFINITY;
+    for (l = 0; l < L; l++) {
+      if (w[f * L + l] < flo)
+        flo = w[f * L + l];
+      if (w[f * L + l] > fhi)
+        fhi = w[f * L + l];
+    }
+    range[f] = fhi - flo;
+    if (flo < lo)
+      lo = flo;
+    if (fhi > hi)
+      hi = fhi;
+    /* entropy of P(lang | feature) under a uniform prior */
+    for (m = fhi, z = 0, l = 0; l < L; l++)
+      z += exp(w[f * L + l] - m);
+    for (h = 0, l = 0; l < L; l++) {
+      p = exp(w[f * L + l] - m) / z;
+      if (p > 0)
+        h -= p * log2(p);
+    }
+    v[f] = h;
+    uniform += h > 0.99 * max_h;
+  }
+
+  printf("\nweights (nb_ptc, log P(feature | language))\n");
+  printf("  range                        %.4g .. %.4g\n", lo, hi);
+  print_summary("per-feature spread", range, F);
+  print_summary("per-feature entropy (bits)", v, F);
+  printf("  near-uniform features        %u (entropy > 99%% of %.2f bits: "
+         "pruning candidates)\n",
+         uniform, max_h);
+  free(v);
+  free(range);
+}
+
+/* a feature covers a language when its weight is above that language's
+ * smallest (the smoothing floor for features unseen in training) */
+static void language_stats(void) {
+  unsigned F = lid->num_feats, L = lid->num_langs, f, l, covered;
+  double *w = *lid->nb_ptc, *pc = *lid->nb_pc, floor, m, z;
+
+  /* nb_pc need not be normalized */
+  for (m = pc[0], l = 1; l < L; l++)
+    if (pc[l] > m)
+      m = pc[l];
+  for (z = 0, l = 0; l < L; l++)
+    z += exp(pc[l] - m);
+  printf("\nlanguages (prior, features above the language's floor weight)\n");
+  for (l = 0; l < L; l++) {
+    for (floor = INFINITY, f = 0; f < F; f++)
+      if (w[f * L + l] < floor)
+        floor = w[f * L + l];
+    for (covered = 0, f = 0; f < F; f++)
+      covered += w[f * L + l] > floor;
+    printf("  %-8s %8.5f %6u %5.1f%%\n", get_lang_name(lid, l),
+           exp(pc[l] - m) / z, covered, 100.0 * covered / F);
+  }
+}
+
+static void memory_stats(void) {
+  unsigned n = lid->num_states, s;
+  size_t outputs = 0, names = 0, F = lid->num_feats, L = lid->num_langs;
+  FeatureHash *h;
+
+  for (s = 0; s < n; s++)
+    outputs += (*lid->tk_output_c)[s];
+  for (s = 0; s < L; s++)
+    names += sizeof(char *) + strlen(get_lang_name(lid, s)) + 1;
+
+  printf("\nmemory\n");
+  print_size("tk_nextmove", (size_t)n * 256 * sizeof(unsigned));
+  print_size("tk_output_c + tk_output_s", 2 * (size_t)n * sizeof(unsigned));
+  print_size("tk_output", outputs * sizeof(unsigned));
+  print_size("nb_ptc", F * L * sizeof(double));
+  print_size("nb_ptc as float", F * L * sizeof(float));
+  print_size("nb_pc + nb_classes", L * sizeof(double) + names);
+  print_size("sparse sets (per context)",
+             3 * ((size_t)n + F) * sizeof(unsigned));
+  if ((h = build_feature_hash(lid))) {
+    print_size("scan hash tables",
+               HASHFV_DIRECT * sizeof(unsigned) +
+                   ((size_t)HASHFV_BUCKET << (64 - h->shift)) *
+                       (sizeof(uint64_t) + sizeof(unsigned)));
+    free_feature_hash(h);
+  } else
+    printf("  %-28s (features longer than %d bytes)\n", "scan hash tables",
+           HASHFV_MAX_LEN);
+}
+
+int main(int argc, char **argv) {
+  char *model_path = NULL;
+  struct stat st;
+  int c;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'm':
+      model_path = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+
+  lid = model_path ? load_identifier(model_path) : get_default_identifier();
+  printf("model: %s", model_path ? model_path : "in-built");
+  if (model_path && !stat(model_path, &st))
+    printf(" (%lld bytes encoded)", (long long)st.st_size);
+  printf("\n  features %u, languages %u, states %u\n", lid->num_feats,
+         lid->num_langs, lid->num_states);
+
+  memory_stats();
+  dfa_stats();
+  weight_stats();
+  language_stats();
+
+  destroy_identifier(lid);
+  return 0;
+}
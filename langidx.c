@@ -0,0 +1,153 @@
+/*
+ * Query a language index sidecar written by `langid -l -x`: count or
+ * extract the lines of the indexed file that are in a set of languages,
+ * without reclassifying them.
+ */
+
+#include "sidecar.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+char const *getoptspec = "hcsvx:e:";
+
+void usage() {
+  printf("langidx -x index [-c] [-s] [-v] [-e langs] [file] (%s)\n"
+         "\n -x: sidecar index written by langid -x"
+         "\n -e: comma-separated languages to select (default all; 'none' "
+         "selects lines that weren't identified)"
+         "\n -v: select lines NOT in -e"
+         "\n -c: print the number of selected lines (file not needed)"
+         "\n -s: print per-language line counts (file not needed)"
+         "\n otherwise write the selected lines of file (default stdin, which "
+         "must be seekable) to stdout"
+         "\n\n",
+         getoptspec);
+}
+
+void error(char const *msg) {
+  fprintf(stderr, "%s\n", msg);
+  exit(-1);
+}
+
+char selected[SIDECAR_NONE + 1];
+
+void select_langs(SidecarReader *r, char *langs) {
+  char *name;
+  unsigned i;
+  for (name = strtok(langs, ","); name; name = strtok(NULL, ",")) {
+    if (!strcmp(name, "none"))
+      i = SIDECAR_NONE;
+    else if ((i = sidecar_lang_index(r, name)) == SIDECAR_NONE) {
+      fprintf(stderr, "ERROR: language '%s' is not in the index\n", name);
+      exit(-1);
+    }
+    selected[i] = 1;
+  }
+}
+
+int main(int argc, char **argv) {
+  int c, c_flag = 0, s_flag = 0, v_flag = 0, fd = 0;
+  char *fx = NULL, *langs = NULL;
+  SidecarReader *r;
+  unsigned i;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'h':
+      usage();
+      return 0;
+    case 'c':
+      c_flag = 1;
+      break;
+    case 's':
+      s_flag = 1;
+      break;
+    case 'v':
+      v_flag = 1;
+      break;
+    case 'x':
+      fx = optarg;
+      break;
+    case 'e':
+      langs = optarg;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  if (!fx)
+    error("-x index is required");
+
+  r = load_sidecar(fx);
+  if (langs)
+    select_langs(r, langs);
+  else
+    memset(selected, 1, sizeof(selected));
+  if (v_flag)
+    for (i = 0; i <= SIDECAR_NONE; i++)
+      selected[i] = !selected[i];
+
+  if (s_flag) {
+    for (i = 0; i < r->num_langs; i++)
+      if (sidecar_count(r, i))
+        printf("%s\t%llu\n", r->names[i],
+               (unsigned long long)sidecar_count(r, i));
+    if (sidecar_count(r, SIDECAR_NONE))
+      printf("none\t%llu\n",
+             (unsigned long long)sidecar_count(r, SIDECAR_NONE));
+  } else if (c_flag) {
+    /* counts come from the trailer, so this doesn't touch the records */
+    unsigned long long n = 0;
+    for (i = 0; i < r->num_langs; i++)
+      if (selected[i])
+        n += sidecar_count(r, i);
+    if (selected[SIDECAR_NONE])
+      n += sidecar_count(r, SIDECAR_NONE);
+    printf("%llu\n", n);
+  } else {
+    unsigned char const *p;
+    char const *data;
+    uint64_t off = 0, run = 0, len, datalen;
+    unsigned lang;
+
+    if (optind < argc && (fd = open(argv[optind], O_RDONLY)) == -1) {
+      fprintf(stderr, "ERROR: couldn't open '%s'\n", argv[optind]);
+      exit(-1);
+    }
+    datalen = lseek(fd, 0, SEEK_END);
+    if ((off_t)datalen == -1)
+      error("indexed file must be seekable");
+    data = datalen ? (char const *)mmap(NULL, datalen, PROT_READ, MAP_PRIVATE,
+                                        fd, 0)
+                   : NULL;
+    if (data == MAP_FAILED)
+      error("couldn't mmap indexed file");
+    madvise((void *)data, datalen, MADV_SEQUENTIAL);
+
+    /* write maximal runs of consecutive selected lines with one fwrite */
+    for (p = r->recs; p < r->end; off += len) {
+      p = sidecar_next(p, &lang, &len);
+      if (off + len > datalen)
+        error("index doesn't match file (file too short)");
+      if (!selected[lang]) {
+        if (off > run)
+          fwrite(data + run, 1, off - run, stdout);
+        run = off + len;
+      }
+    }
+    if (off > run)
+      fwrite(data + run, 1, off - run, stdout);
+    if (off != datalen)
+      fprintf(stderr, "WARNING: index covers %llu of %llu bytes\n",
+              (unsigned long long)off, (unsigned long long)datalen);
+    if (data)
+      munmap((void *)data, datalen);
+  }
+  destroy_sidecar(r);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * On-disk ordering of batch-mode reads; see layout.h
+ */
+
+#include "layout.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+/* the physical offset of fd's first byte, or -1 if unknown */
+static int64_t first_extent(int fd) {
+#ifdef FS_IOC_FIEMAP
+  uint64_t buf[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t)];
+  struct fiemap* m = (struct fiemap*)buf;
+  memset(buf, 0, sizeof(buf));
+  m->fm_length = FIEMAP_MAX_OFFSET;
+  m->fm_extent_count = 1;
+  if (!ioctl(fd, FS_IOC_FIEMAP, m) && m->fm_mapped_extents &&
+      !(m->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)))
+    return m->fm_extents[0].fe_physical;
+#endif
+  return -1;
+}
+
+void layout_key(char const* path, LayoutKey* k) {
+  struct stat st;
+  int64_t physical;
+  int fd;
+
+  memset(k, 0, sizeof(*k));
+  if ((fd = open(path, O_RDONLY)) == -1) return;
+  if (!fstat(fd, &st)) {
+    k->dev = st.st_dev;
+    /* empty files have no extents */
+    physical = S_ISREG(st.st_mode) && st.st_size ? first_extent(fd) : -1;
+    k->physical = physical != -1;
+    k->key = physical != -1 ? (uint64_t)physical : st.st_ino;
+  }
+  close(fd);
+}
+
+static LayoutKey const* sort_keys;
+
+static int cmp_layout(void const* a, void const* b) {
+  size_t i = *(size_t const*)a, j = *(size_t const*)b;
+  LayoutKey const *x = &sort_keys[i], *y = &sort_keys[j];
+  if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+  if (x->physical != y->physical) return x->physical < y->physical ? -1 : 1;
+  if (x->key != y->key) return x->key < y->key ? -1 : 1;
+  return i < j ? -1 : i > j;
+}
+
+void layout_order(LayoutKey const* keys, size_t n, size_t* order) {
+  size_t i;
+  for (i = 0; i < n; i++) order[i] = i;
+  sort_keys = keys;
+  qsort(order, n, sizeof(size_t), cmp_layout);
+}
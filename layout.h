@@ -0,0 +1,26 @@
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Ordering batch-mode reads by where files lie on disk. When reads are
+ * seek-bound (spinning disks, cold network-backed volumes), reading a
+ * window of files by the physical offset of their first extent (FIEMAP)
+ * turns random seeks into a sweep. Where the filesystem can't say (tmpfs,
+ * NFS, ...) the inode number stands in, since most filesystems allocate
+ * data near its inode.
+ */
+typedef struct {
+  dev_t dev;
+  int physical; /* key is a byte offset on dev, else an inode number */
+  uint64_t key;
+} LayoutKey;
+
+/** where path's data starts; all zero if it can't be opened */
+extern void layout_key(char const* path, LayoutKey*);
+/** order[0..n) = 0..n-1 sorted by device, then key (ties by index) */
+extern void layout_order(LayoutKey const* keys, size_t n, size_t* order);
+
+#endif
@@ -7,21 +7,49 @@
  */
 
 #include "liblangid.h"
+#include "hashfv.h"
 #include "langid.pb-c.h"
 #include "model.h"
+#include "probes.h"
 #include "sparseset.h"
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+LANGID_DEFINE_PROBE_SEMAPHORES
+
+/* Set TK_EMITS on every transition into a state that completes features.
+ */
+static void flag_emitting_states(LanguageIdentifier* lid) {
+  unsigned* move = &(*lid->tk_nextmove)[0][0];
+  unsigned* end = move + 256 * (size_t)lid->num_states;
+  for (; move < end; ++move)
+    if ((*lid->tk_output_c)[TK_STATE(*move)]) *move |= TK_EMITS;
+}
+
+/* the in-built tables are shared by every identifier made from them, which
+ * may be made concurrently, so they are flagged once */
+static pthread_once_t builtin_once = PTHREAD_ONCE_INIT;
+
+static void flag_builtin(void) {
+  LanguageIdentifier builtin;
+  builtin.num_states = NUM_STATES;
+  builtin.tk_nextmove = &tk_nextmove;
+  builtin.tk_output_c = &tk_output_c;
+  flag_emitting_states(&builtin);
+}
+
 /* Return a pointer to a LanguageIdentifier based on the in-built default model
  */
 LanguageIdentifier* get_default_identifier(void) {
   LanguageIdentifier* lid;
 
+  /* a pointer: <sys/sdt.h> can't take an array (a string literal) */
+  LANGID_PROBE(model__load__start, (char const*)"");
   if ((lid = (LanguageIdentifier*)malloc(sizeof(LanguageIdentifier))) == 0) exit(-1);
 
   lid->sv = alloc_set(NUM_STATES);
@@ -39,15 +67,103 @@ LanguageIdentifier* get_default_identifier(void) {
   lid->nb_classes = &nb_classes;
 
   lid->protobuf_model = NULL;
+  lid->model_arena = NULL;
+  lid->tk_state = 0;
+  lid->nb_ptc_f = NULL;
+  lid->owns_nb_ptc_f = 0;
+  lid->fhash = NULL;
+  lid->owns_fhash = 0;
 
+  pthread_once(&builtin_once, flag_builtin);
+
+  set_engine(lid, host_config());
+
+  LANGID_PROBE(model__load__done, (char const*)"", lid->num_langs, lid->num_feats);
   return lid;
 }
 
+/*
+ * Bump allocator for unpacking a protobuf model: everything protobuf-c
+ * allocates for the model comes out of one anonymous mapping, which
+ * destroy_identifier releases with a single munmap instead of a free per
+ * repeated field and string. Should the mapping run out, blocks come from
+ * malloc and are kept on a list to be freed along with it.
+ */
+typedef struct ArenaBlock {
+  struct ArenaBlock *prev, *next;
+} ArenaBlock;
+
+typedef struct {
+  size_t size, used;
+  ArenaBlock* overflow;
+} ModelArena;
+
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+static void* arena_alloc(void* data, size_t size) {
+  ModelArena* a = (ModelArena*)data;
+  size_t n = ARENA_ALIGN(size);
+  ArenaBlock* b;
+  void* p;
+  if (n <= a->size - a->used) {
+    p = (char*)a + a->used;
+    a->used += n;
+    return p;
+  }
+  if ((b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size)) == 0) return NULL;
+  b->prev = NULL;
+  if ((b->next = a->overflow)) b->next->prev = b;
+  a->overflow = b;
+  return b + 1;
+}
+
+/* only overflow blocks are freed individually (protobuf-c frees its scratch
+ * during unpack) */
+static void arena_free(void* data, void* p) {
+  ModelArena* a = (ModelArena*)data;
+  ArenaBlock* b;
+  if (!p || ((char*)p >= (char*)a && (char*)p < (char*)a + a->size)) return;
+  b = (ArenaBlock*)p - 1;
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    a->overflow = b->next;
+  if (b->next) b->next->prev = b->prev;
+  free(b);
+}
+
+/* The unpacked model is normally at most 8 times the size of its encoding:
+ * the worst case is a 1-byte varint becoming an int32, or a 2-byte empty
+ * string becoming a pointer plus an aligned NUL. The mapping is only
+ * reserved, so pages that aren't used are never touched.
+ */
+static ModelArena* alloc_arena(size_t model_len) {
+  size_t size = 8 * model_len + (1 << 16);
+  ModelArena* a =
+      (ModelArena*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (a == MAP_FAILED) exit(-1);
+  a->size = size;
+  a->used = ARENA_ALIGN(sizeof(ModelArena));
+  a->overflow = NULL;
+  return a;
+}
+
+static void free_arena(ModelArena* a) {
+  ArenaBlock *b, *next;
+  for (b = a->overflow; b; b = next) {
+    next = b->next;
+    free(b);
+  }
+  munmap(a, a->size);
+}
+
 LanguageIdentifier* load_identifier(char const* model_path) {
   Langid__LanguageIdentifier* msg;
   int fd, model_len;
   unsigned char* model_buf;
   LanguageIdentifier* lid;
+  ModelArena* arena;
+  ProtobufCAllocator allocator;
 #ifdef DEBUG
   int i;
 #endif
@@ -55,6 +171,7 @@ LanguageIdentifier* load_identifier(char const* model_path) {
 #ifdef DEBUG
   fprintf(stderr, "loading a model from: %s\n", model_path);
 #endif
+  LANGID_PROBE(model__load__start, model_path);
 
   /* Use mmap to access the model file */
   if ((fd = open(model_path, O_RDONLY)) == -1) {
@@ -62,10 +179,24 @@ LanguageIdentifier* load_identifier(char const* model_path) {
     exit(-1);
   }
   model_len = lseek(fd, 0, SEEK_END);
-  model_buf = (unsigned char*)mmap(NULL, model_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  model_buf = (unsigned char*)mmap(NULL, model_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (model_buf == MAP_FAILED) {
+    fprintf(stderr, "unable to mmap: %s\n", model_path);
+    exit(-1);
+  }
+  madvise(model_buf, model_len, MADV_SEQUENTIAL);
+
+  arena = alloc_arena(model_len);
+  allocator.alloc = arena_alloc;
+  allocator.free = arena_free;
+  allocator.allocator_data = arena;
 
   /*printf("read in a model of size %d\n", model_len);*/
-  msg = langid__language_identifier__unpack(NULL, model_len, model_buf);
+  msg = langid__language_identifier__unpack(&allocator, model_len, model_buf);
+
+  /* everything has been copied out of the encoded model */
+  munmap(model_buf, model_len);
+  close(fd);
 
   if (msg == NULL) {
     fprintf(stderr, "error unpacking model from: %s\n", model_path);
@@ -104,33 +235,99 @@ LanguageIdentifier* load_identifier(char const* model_path) {
 #endif
 
   lid->protobuf_model = msg;
+  lid->model_arena = arena;
+  lid->tk_state = 0;
+  lid->nb_ptc_f = NULL;
+  lid->owns_nb_ptc_f = 0;
+  lid->fhash = NULL;
+  lid->owns_fhash = 0;
+
+  flag_emitting_states(lid);
+  set_engine(lid, host_config());
 
+  LANGID_PROBE(model__load__done, model_path, lid->num_langs, lid->num_feats);
   return lid;
 }
 
+/* Return a LanguageIdentifier that shares lid's model but has its own
+ * scratch space, so that it can be used concurrently with lid (e.g. by
+ * another thread). It must be destroyed before lid.
+ */
+LanguageIdentifier* clone_identifier(LanguageIdentifier* lid) {
+  LanguageIdentifier* clone;
+
+  if ((clone = (LanguageIdentifier*)malloc(sizeof(LanguageIdentifier))) == 0) exit(-1);
+  *clone = *lid;
+  clone->sv = alloc_set(lid->num_states);
+  clone->fv = alloc_set(lid->num_feats);
+  /* the model belongs to lid */
+  clone->protobuf_model = NULL;
+  clone->model_arena = NULL;
+  clone->tk_state = 0;
+  clone->owns_nb_ptc_f = 0;
+  clone->owns_fhash = 0;
+
+  return clone;
+}
+
+void set_engine(LanguageIdentifier* lid, LangidConfig const* cfg) {
+  size_t i, n;
+
+  lid->scan = cfg->scan;
+  lid->short_max = cfg->short_max < SHORT_TEXT_MAX ? cfg->short_max : SHORT_TEXT_MAX;
+  if (cfg->scan == SCAN_HASH && !lid->fhash) {
+    if ((lid->fhash = build_feature_hash(lid)))
+      lid->owns_fhash = 1;
+    else
+      lid->scan = SCAN_MASK;
+  }
+  if (cfg->weights == WEIGHTS_FLOAT && !lid->nb_ptc_f) {
+    n = (size_t)lid->num_feats * lid->num_langs;
+    if ((lid->nb_ptc_f = (float(*)[])malloc(n * sizeof(float))) == 0) exit(-1);
+    for (i = 0; i < n; i++)
+      (*lid->nb_ptc_f)[i] = (float)(*lid->nb_ptc)[i];
+    lid->owns_nb_ptc_f = 1;
+  } else if (cfg->weights == WEIGHTS_DOUBLE && lid->nb_ptc_f) {
+    if (lid->owns_nb_ptc_f) free(lid->nb_ptc_f);
+    lid->nb_ptc_f = NULL;
+    lid->owns_nb_ptc_f = 0;
+  }
+}
+
 void destroy_identifier(LanguageIdentifier* lid) {
-  if (lid->protobuf_model != NULL) langid__language_identifier__free_unpacked(lid->protobuf_model, NULL);
+  if (lid->owns_nb_ptc_f) free(lid->nb_ptc_f);
+  if (lid->owns_fhash) free_feature_hash(lid->fhash);
+  /* protobuf_model lives in model_arena */
+  if (lid->model_arena != NULL) free_arena((ModelArena*)lid->model_arena);
   free_set(lid->sv);
   free_set(lid->fv);
   free(lid);
 }
 
+size_t model_size(LanguageIdentifier* lid) {
+  size_t n = 0;
+  FeatureHash* h = lid->fhash;
+  /* overflow blocks are rare and small enough not to count */
+  if (lid->model_arena) n += ((ModelArena*)lid->model_arena)->used;
+  if (lid->owns_nb_ptc_f) n += (size_t)lid->num_feats * lid->num_langs * sizeof(float);
+  if (lid->owns_fhash)
+    n += sizeof(FeatureHash) + HASHFV_DIRECT * sizeof(unsigned) +
+         ((size_t)HASHFV_BUCKET << (64 - h->shift)) * (sizeof(uint64_t) + sizeof(unsigned));
+  return n;
+}
+
+size_t scratch_size(LanguageIdentifier* lid) {
+  return sizeof(LanguageIdentifier) + 2 * sizeof(Set) + 3 * sizeof(unsigned) * (lid->num_states + lid->num_feats);
+}
+
 /*
- * Convert a text stream into a feature vector. The feature vector counts
- * how many times each sequence is seen.
+ * Expand the per-state counts in sv into per-feature counts in fv.
  */
-void text_to_fv(LanguageIdentifier* lid, char const* text, unsigned textlen, Set* sv, Set* fv) {
-  unsigned i, j, m, s = 0;
+void sv_to_fv(LanguageIdentifier* lid, Set* sv, Set* fv) {
+  unsigned i, j, m;
 
-  clear(sv);
   clear(fv);
 
-  for (i = 0; i < textlen; i++) {
-    s = (*lid->tk_nextmove)[s][(unsigned char)text[i]];
-    add(sv, s, 1);
-  }
-
-  /* convert the SV into the FV */
   for (i = 0; i < sv->members; i++) {
     m = sv->dense[i];
     for (j = 0; j < (*lid->tk_output_c)[m]; j++) {
@@ -141,14 +338,60 @@ void text_to_fv(LanguageIdentifier* lid, char const* text, unsigned textlen, Set
   return;
 }
 
+/*
+ * Convert a text stream into a feature vector. The feature vector counts
+ * how many times each sequence is seen.
+ */
+void text_to_fv(LanguageIdentifier* lid, char const* text, unsigned textlen, Set* sv, Set* fv) {
+  unsigned i, move, s = 0;
+
+  clear(sv);
+
+  if (lid->scan == SCAN_HASH) {
+    hash_text_to_fv(lid->fhash, text, textlen, fv);
+    return;
+  }
+
+  /* SCAN_MASK counts states that complete no features as state 0, which
+   * completes none either, rather than branching on TK_EMITS: the branch
+   * is data-dependent and usually mispredicts */
+  if (lid->scan == SCAN_BRANCH) {
+    for (i = 0; i < textlen; i++) {
+      move = (*lid->tk_nextmove)[s][(unsigned char)text[i]];
+      s = TK_STATE(move);
+      if (move & TK_EMITS) add(sv, s, 1);
+    }
+  } else {
+    for (i = 0; i < textlen; i++) {
+      move = (*lid->tk_nextmove)[s][(unsigned char)text[i]];
+      s = TK_STATE(move);
+      add(sv, s & -(move >> 31), 1);
+    }
+  }
+
+  sv_to_fv(lid, sv, fv);
+}
+
 void fv_to_logprob(LanguageIdentifier* lid, Set* fv, double logprob[]) {
   unsigned i, j, m;
   double* nb_ptc_p;
+  float* nb_ptc_f;
   /* Initialize using prior */
   for (i = 0; i < lid->num_langs; i++) {
     logprob[i] = (*lid->nb_pc)[i];
   }
 
+  /* WEIGHTS_FLOAT: half the memory traffic; sums are still doubles */
+  if (lid->nb_ptc_f) {
+    for (i = 0; i < fv->members; i++) {
+      m = fv->dense[i];
+      nb_ptc_f = &(*lid->nb_ptc_f)[m * lid->num_langs];
+      for (j = 0; j < lid->num_langs; j++)
+        logprob[j] += fv->counts[i] * (double)nb_ptc_f[j];
+    }
+    return;
+  }
+
   /* Compute posterior for each class */
   for (i = 0; i < fv->members; i++) {
     m = fv->dense[i];
@@ -174,18 +417,123 @@ LangIndex logprob_to_pred(LanguageIdentifier* lid, double* logprob) {
   return logprob_to_pred_n(logprob, lid->num_langs);
 }
 
+/* Shell sort: short, and fast enough for SHORT_TEXT_MAX states */
+static void sort_states(unsigned* a, unsigned n) {
+  static unsigned const gaps[] = {57, 23, 10, 4, 1};
+  unsigned g, i, j, gap, x;
+  for (g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++)
+    for (gap = gaps[g], i = gap; i < n; i++) {
+      x = a[i];
+      for (j = i; j >= gap && a[j - gap] > x; j -= gap)
+        a[j] = a[j - gap];
+      a[j] = x;
+    }
+}
+
+/*
+ * For short texts, setting up the sparse sets and expanding states into
+ * features cost as much as the scan. Instead, the emitting states are
+ * written to a stack buffer, sorted so that repeats are adjacent, and each
+ * distinct state's features are scored directly, weighted by its count:
+ * scoring is linear in the feature counts, so features needn't be merged.
+ * Features shared by several states (suffixes) are scored once per state,
+ * which is why longer texts are better off with the general path.
+ */
+void short_text_logprobs(LanguageIdentifier* lid, char const* text, unsigned textlen, double* logprob) {
+  unsigned states[SHORT_TEXT_MAX], i, j, k, n = 0, move, s = 0, m, c, L = lid->num_langs;
+  double* nb_ptc_p;
+  float* nb_ptc_f;
+
+  assert(textlen <= SHORT_TEXT_MAX);
+  for (i = 0; i < textlen; i++) {
+    move = (*lid->tk_nextmove)[s][(unsigned char)text[i]];
+    s = TK_STATE(move);
+    states[n] = s;
+    n += move >> 31;
+  }
+  sort_states(states, n);
+
+  memcpy(logprob, *lid->nb_pc, L * sizeof(double));
+  for (i = 0; i < n; i = k) {
+    s = states[i];
+    for (k = i + 1; k < n && states[k] == s; k++)
+      ;
+    c = k - i;
+    for (j = 0; j < (*lid->tk_output_c)[s]; j++) {
+      m = (*lid->tk_output)[(*lid->tk_output_s)[s] + j];
+      if (lid->nb_ptc_f) {
+        nb_ptc_f = &(*lid->nb_ptc_f)[m * L];
+        for (m = 0; m < L; m++)
+          logprob[m] += c * (double)nb_ptc_f[m];
+      } else {
+        nb_ptc_p = &(*lid->nb_ptc)[m * L];
+        for (m = 0; m < L; m++)
+          logprob[m] += c * nb_ptc_p[m];
+      }
+    }
+  }
+}
+
 void identify_logprobs(LanguageIdentifier* lid, char const* text, unsigned textlen, double* logprobs) {
 #ifdef DEBUG
   int i;
 #endif
-  text_to_fv(lid, text, textlen, lid->sv, lid->fv);
-  fv_to_logprob(lid, lid->fv, logprobs);
+  LANGID_PROBE(identify__start, lid, textlen);
+  if (textlen <= lid->short_max) {
+    short_text_logprobs(lid, text, textlen, logprobs);
+  } else {
+    text_to_fv(lid, text, textlen, lid->sv, lid->fv);
+    fv_to_logprob(lid, lid->fv, logprobs);
+  }
+  if (LANGID_PROBE_ENABLED(identify__done))
+    LANGID_PROBE(identify__done, lid, textlen, get_lang_name(lid, logprob_to_pred(lid, logprobs)));
 #ifdef DEBUG
   for (i = 0; i < lid->num_langs; i++)
     fprintf(stderr, "  lang: %s logprob: %lf\n", (*lid->nb_classes)[i], logprobs[i]);
 #endif
 }
 
+Set const* identify_features(LanguageIdentifier* lid, char const* text, unsigned textlen) {
+  text_to_fv(lid, text, textlen, lid->sv, lid->fv);
+  return lid->fv;
+}
+
+/*
+ * Incremental identification: the text is supplied in any number of pieces
+ * (e.g. as it is decoded), and the result is the same as identify_logprobs
+ * over their concatenation.
+ */
+void identify_begin(LanguageIdentifier* lid) {
+  clear(lid->sv);
+  lid->tk_state = 0;
+}
+
+/* SCAN_HASH would have to carry n-grams across pieces, so feeding always
+ * walks the DFA */
+void identify_feed(LanguageIdentifier* lid, char const* text, unsigned textlen) {
+  unsigned i, move, s = lid->tk_state;
+  Set* sv = lid->sv;
+  if (lid->scan == SCAN_BRANCH) {
+    for (i = 0; i < textlen; i++) {
+      move = (*lid->tk_nextmove)[s][(unsigned char)text[i]];
+      s = TK_STATE(move);
+      if (move & TK_EMITS) add(sv, s, 1);
+    }
+  } else {
+    for (i = 0; i < textlen; i++) {
+      move = (*lid->tk_nextmove)[s][(unsigned char)text[i]];
+      s = TK_STATE(move);
+      add(sv, s & -(move >> 31), 1);
+    }
+  }
+  lid->tk_state = s;
+}
+
+void identify_end_logprobs(LanguageIdentifier* lid, double* logprobs) {
+  sv_to_fv(lid, lid->sv, lid->fv);
+  fv_to_logprob(lid, lid->fv, logprobs);
+}
+
 double identify_logprob(LanguageIdentifier* lid, LangIndex i, char const* text, unsigned textlen) {
   assert(i < lid->num_langs);
   double logprobs[lid->num_langs];
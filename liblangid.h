@@ -1,9 +1,17 @@
 #ifndef _LANGID_H
 #define _LANGID_H
 
+#include "config.h"
 #include "langid.pb-c.h"
 #include "sparseset.h"
 
+/* tk_nextmove entries are the next state, with TK_EMITS set if that state
+ * completes any features (tk_output_c[state] > 0); only those states need
+ * their own counts while scanning. load_identifier and get_default_identifier set it.
+ */
+#define TK_EMITS 0x80000000u
+#define TK_STATE(move) ((move) & ~TK_EMITS)
+
 /* Structure containing all the state required to
  * implement a language identifier
  */
@@ -23,17 +31,45 @@ typedef struct {
   char* (*nb_classes)[];
 
   Langid__LanguageIdentifier* protobuf_model;
+  /* holds protobuf_model and everything it points to (see load_identifier) */
+  void* model_arena;
 
   /* sparsesets for counting states and features. these are
    * part of LanguageIdentifier as the clear operation on them
    * is much less costly than allocating them from scratch
    */
   Set *sv, *fv;
+
+  /* tokenizer state carried between identify_feed calls */
+  unsigned tk_state;
+
+  /* engine variant (see set_engine). nb_ptc_f is nb_ptc as floats when
+   * scoring with WEIGHTS_FLOAT, and fhash the feature table for SCAN_HASH,
+   * otherwise NULL; clones share them */
+  int scan;
+  float (*nb_ptc_f)[];
+  int owns_nb_ptc_f;
+  struct FeatureHash* fhash;
+  int owns_fhash;
+  /* identify uses short_text_logprobs for texts up to this long */
+  unsigned short_max;
 } LanguageIdentifier;
 
 extern LanguageIdentifier* get_default_identifier(void);
 extern LanguageIdentifier* load_identifier(char const*);
 extern void destroy_identifier(LanguageIdentifier*);
+/** shares the model, with separate scratch for concurrent use; destroy it
+    before the original */
+extern LanguageIdentifier* clone_identifier(LanguageIdentifier*);
+/** use cfg's scan and weights variants (threads is for callers); a model
+    SCAN_HASH can't represent keeps SCAN_MASK. get_default_identifier and
+    load_identifier apply host_config() */
+extern void set_engine(LanguageIdentifier*, LangidConfig const* cfg);
+/** bytes held for lid's model, which clones share: the unpacked tables of
+    a loaded model (the built-in one's are in the binary), plus engine
+    tables it owns. scratch_size is the bytes of each clone's own */
+extern size_t model_size(LanguageIdentifier*);
+extern size_t scratch_size(LanguageIdentifier*);
 
 typedef unsigned LangIndex;  // -1 = not found
 typedef struct {
@@ -53,6 +89,26 @@ extern LangIndex get_lang_index(LanguageIdentifier*, char const*);
 extern double identify_logprob(LanguageIdentifier*, LangIndex, char const*, unsigned);
 extern void identify_logprobs(LanguageIdentifier*, char const*, LangIndex, double*);
 
+/** the sparse feature vector (byte n-gram counts) of text, as used by
+    identify: feature ids in dense[0..members) with counts in counts[]. points
+    into the LanguageIdentifier, so is only valid until its next use */
+extern Set const* identify_features(LanguageIdentifier*, char const*, unsigned);
+extern void text_to_fv(LanguageIdentifier*, char const*, unsigned, Set* sv, Set* fv);
+extern void fv_to_logprob(LanguageIdentifier*, Set* fv, double* logprobs);
+
+/** short_text_logprobs takes texts up to SHORT_TEXT_MAX long; identify
+    uses it up to lid->short_max (the config's short, see config.h), where
+    it stops being faster (see shortbench). it doesn't use lid->sv and
+    lid->fv (call identify_features for those) */
+#define SHORT_TEXT_MAX 256
+extern void short_text_logprobs(LanguageIdentifier*, char const*, unsigned, double*);
+
+/** incremental identification: begin, feed the text in any number of pieces,
+    then end_logprobs fills logprobs as identify_logprobs would for the whole */
+extern void identify_begin(LanguageIdentifier*);
+extern void identify_feed(LanguageIdentifier*, char const*, unsigned);
+extern void identify_end_logprobs(LanguageIdentifier*, double*);
+
 /** make the largest logprob 0 and the (worse) logprobs <0 */
 extern void normalize_logprobs_n(double*, LangIndex);
 extern void identify_normalize_logprobs(LanguageIdentifier*, double*);
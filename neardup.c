@@ -0,0 +1,146 @@
+/*
+ * MinHash / LSH near-duplicate reuse; see neardup.h
+ */
+
+#include "neardup.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MUL1 0x9e3779b97f4a7c15ull
+#define MUL2 0xbf58476d1ce4e5b9ull
+
+NearDup* open_neardup(double threshold) {
+  NearDup* n;
+  if ((n = (NearDup*)calloc(1, sizeof(NearDup))) == 0) exit(-1);
+  n->threshold = threshold;
+  n->table_size = 1024;
+  if ((n->keys = (uint64_t*)calloc(n->table_size, sizeof(uint64_t))) == 0) exit(-1);
+  if ((n->reps = (uint32_t*)malloc(n->table_size * sizeof(uint32_t))) == 0) exit(-1);
+  return n;
+}
+
+void close_neardup(NearDup* n) {
+  free(n->sketches);
+  free(n->labels);
+  free(n->stamps);
+  free(n->keys);
+  free(n->reps);
+  free(n);
+}
+
+int sketch_text(char const* text, size_t len, Sketch* s) {
+  uint64_t w = 0, h;
+  uint32_t v;
+  size_t i;
+  unsigned k;
+
+  if (len < NEARDUP_MIN_LEN) return 0;
+  memset(s->min, 0xff, sizeof s->min);
+  for (i = 0; i < len; i++) {
+    w = w << 8 | (unsigned char)text[i];
+    h = w * MUL1;
+    k = h >> 59; /* top bits pick the slot: NEARDUP_K is 32 */
+    v = (uint32_t)(((h ^ (h >> 31)) * MUL2) >> 32);
+    if (v < s->min[k]) s->min[k] = v;
+  }
+  return 1;
+}
+
+/* a band's key is never 0, which marks an empty table entry */
+static uint64_t band_key(Sketch const* s, unsigned band) {
+  uint64_t h = band + 1;
+  unsigned r;
+  for (r = 0; r < NEARDUP_ROWS; r++)
+    h = (h ^ s->min[band * NEARDUP_ROWS + r]) * MUL1;
+  return h | 1;
+}
+
+static double similarity(Sketch const* a, Sketch const* b) {
+  unsigned k, same = 0;
+  for (k = 0; k < NEARDUP_K; k++)
+    same += a->min[k] == b->min[k];
+  return (double)same / NEARDUP_K;
+}
+
+LangIndex neardup_lookup(NearDup* n, Sketch const* s) {
+  LangIndex label = (LangIndex)-1;
+  double sim, best = 0;
+  size_t mask = n->table_size - 1, i;
+  unsigned band;
+  uint64_t key;
+  uint32_t rep;
+  int conflict = 0;
+
+  n->docs++;
+  n->doc++;
+  for (band = 0; band < NEARDUP_BANDS; band++) {
+    key = band_key(s, band);
+    for (i = (key * MUL2) >> 32 & mask; n->keys[i]; i = (i + 1) & mask) {
+      if (n->keys[i] != key || n->stamps[rep = n->reps[i]] == n->doc) continue;
+      n->stamps[rep] = n->doc;
+      if ((sim = similarity(s, &n->sketches[rep])) < n->threshold - NEARDUP_MARGIN) continue;
+      if (label != (LangIndex)-1 && n->labels[rep] != label) conflict = 1;
+      if (sim > best) {
+        best = sim;
+        label = n->labels[rep];
+      }
+    }
+  }
+  if (best < n->threshold) return (LangIndex)-1;
+  if (conflict) {
+    n->ambiguous++;
+    return (LangIndex)-1;
+  }
+  n->reused++;
+  return label;
+}
+
+static void grow_table(NearDup* n) {
+  uint64_t* keys = n->keys;
+  uint32_t* reps = n->reps;
+  size_t size = n->table_size, i, j, mask;
+
+  n->table_size *= 2;
+  mask = n->table_size - 1;
+  if ((n->keys = (uint64_t*)calloc(n->table_size, sizeof(uint64_t))) == 0) exit(-1);
+  if ((n->reps = (uint32_t*)malloc(n->table_size * sizeof(uint32_t))) == 0) exit(-1);
+  for (i = 0; i < size; i++)
+    if (keys[i]) {
+      for (j = (keys[i] * MUL2) >> 32 & mask; n->keys[j]; j = (j + 1) & mask)
+        ;
+      n->keys[j] = keys[i];
+      n->reps[j] = reps[i];
+    }
+  free(keys);
+  free(reps);
+}
+
+void neardup_add(NearDup* n, Sketch const* s, LangIndex label) {
+  size_t mask, i;
+  unsigned band;
+  uint64_t key;
+  uint32_t rep;
+
+  if (n->num_reps == NEARDUP_MAX_REPS) return;
+  if (n->num_reps == n->cap_reps) {
+    n->cap_reps = n->cap_reps ? 2 * n->cap_reps : 1024;
+    if ((n->sketches = (Sketch*)realloc(n->sketches, n->cap_reps * sizeof(Sketch))) == 0) exit(-1);
+    if ((n->labels = (LangIndex*)realloc(n->labels, n->cap_reps * sizeof(LangIndex))) == 0) exit(-1);
+    if ((n->stamps = (uint32_t*)realloc(n->stamps, n->cap_reps * sizeof(uint32_t))) == 0) exit(-1);
+  }
+  rep = n->num_reps++;
+  n->sketches[rep] = *s;
+  n->labels[rep] = label;
+  n->stamps[rep] = n->doc;
+
+  if (2 * (n->table_used + NEARDUP_BANDS) > n->table_size) grow_table(n);
+  mask = n->table_size - 1;
+  for (band = 0; band < NEARDUP_BANDS; band++) {
+    key = band_key(s, band);
+    for (i = (key * MUL2) >> 32 & mask; n->keys[i]; i = (i + 1) & mask)
+      ;
+    n->keys[i] = key;
+    n->reps[i] = rep;
+  }
+  n->table_used += NEARDUP_BANDS;
+}
@@ -0,0 +1,52 @@
+#ifndef _NEARDUP_H
+#define _NEARDUP_H
+
+#include "liblangid.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Near-duplicate reuse for batch mode (-N): each document gets a MinHash
+ * sketch of its 8-byte shingles (one-permutation: a shingle's hash picks a
+ * slot and competes for its minimum), and fully identified documents are
+ * kept as representatives in an LSH index of NEARDUP_BANDS bands of
+ * NEARDUP_ROWS slots. A document whose estimated Jaccard similarity to a
+ * representative is at least the threshold takes its label, unless a
+ * representative within NEARDUP_MARGIN of the threshold has another label
+ * (then it is ambiguous and identified in full). Documents shorter than
+ * NEARDUP_MIN_LEN are always identified in full.
+ */
+
+#define NEARDUP_ROWS 4
+#define NEARDUP_BANDS 8
+#define NEARDUP_K (NEARDUP_ROWS * NEARDUP_BANDS)
+#define NEARDUP_MARGIN 0.15
+#define NEARDUP_MIN_LEN 256
+/* representatives kept; later documents are still matched against them */
+#define NEARDUP_MAX_REPS (1u << 20)
+
+typedef struct {
+  uint32_t min[NEARDUP_K];
+} Sketch;
+
+typedef struct {
+  double threshold;
+  Sketch* sketches; /* of the representatives */
+  LangIndex* labels;
+  uint32_t* stamps; /* last document each representative was compared with */
+  uint32_t num_reps, cap_reps, doc;
+  uint64_t* keys; /* band key -> representative, open addressing */
+  uint32_t* reps;
+  size_t table_size, table_used;
+  uint64_t docs, reused, ambiguous;
+} NearDup;
+
+extern NearDup* open_neardup(double threshold);
+extern void close_neardup(NearDup*);
+/** 0 if text is too short to sketch reliably */
+extern int sketch_text(char const* text, size_t len, Sketch*);
+/** the label of a near-duplicate representative, or (LangIndex)-1 */
+extern LangIndex neardup_lookup(NearDup*, Sketch const*);
+/** make a fully identified document a representative */
+extern void neardup_add(NearDup*, Sketch const*, LangIndex);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+/* USDT static tracepoints, provider "langid", for bpftrace, perf or
+ * systemtap on production binaries (see bpftrace/). Each probe site is a
+ * nop plus an ELF note; LANGID_PROBE_ENABLED guards arguments that cost
+ * anything to compute, by the semaphore a tracer sets while attached.
+ * Without <sys/sdt.h> (systemtap-sdt-dev), or with -DLANGID_NO_PROBES,
+ * they compile to nothing.
+ *
+ *   model__load__start(path)                       path "" if built in
+ *   model__load__done(path, num_langs, num_feats)
+ *   identify__start(lid, len)                      identify_logprobs, and
+ *   identify__done(lid, len, lang)                 all built on it; lang
+ *                                                  is the language code
+ *   batch__start(pool, docs, threads)              pool_identify
+ *   batch__steal(thread, victim)
+ *   batch__done(pool, docs)
+ *   ring__claim(records, interactive)              langid -R; interactive
+ *   ring__done(tag, class, latency_ns)             documents now queued;
+ *                                                  class 0 is interactive
+ *   doc__start(path)                               langid -b; len is -1
+ *   doc__open(path, len)                           if it can't be opened
+ *   doc__done(path, len, lang)
+ */
+
+#if !defined(LANGID_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define LANGID_PROBES
+#endif
+#endif
+
+#define LANGID_PROBE_NAMES(X)                                                                          \
+  X(model__load__start)                                                                                \
+  X(model__load__done)                                                                                 \
+  X(identify__start)                                                                                   \
+  X(identify__done)                                                                                    \
+  X(batch__start)                                                                                      \
+  X(batch__steal)                                                                                      \
+  X(batch__done)                                                                                       \
+  X(ring__claim)                                                                                       \
+  X(ring__done)                                                                                        \
+  X(doc__start)                                                                                        \
+  X(doc__open)                                                                                         \
+  X(doc__done)
+
+#ifdef LANGID_PROBES
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define LANGID_PROBE_SEMAPHORE(name) extern unsigned short langid_##name##_semaphore;
+LANGID_PROBE_NAMES(LANGID_PROBE_SEMAPHORE)
+#undef LANGID_PROBE_SEMAPHORE
+/* in one translation unit (liblangid.c) */
+#define LANGID_PROBE_SEMAPHORE_DEF(name) unsigned short langid_##name##_semaphore __attribute__((section(".probes")));
+#define LANGID_DEFINE_PROBE_SEMAPHORES LANGID_PROBE_NAMES(LANGID_PROBE_SEMAPHORE_DEF)
+
+#define LANGID_PROBE(...) STAP_PROBEV(langid, __VA_ARGS__)
+#define LANGID_PROBE_ENABLED(name) __builtin_expect(langid_##name##_semaphore, 0)
+#else
+#define LANGID_DEFINE_PROBE_SEMAPHORES
+static inline void langid_probe_args(int unused, ...) {}
+/* the arguments aren't evaluated, but count as used */
+#define LANGID_PROBE(name, ...) (0 ? langid_probe_args(0, __VA_ARGS__) : (void)0)
+#define LANGID_PROBE_ENABLED(name) 0
+#endif
+
+#endif
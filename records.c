@@ -0,0 +1,130 @@
+/*
+ * Binary-safe record framing for line- and batch-mode input; see records.h
+ */
+
+#include "records.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RECORD_CHUNK (1 << 20)
+
+RecordReader* open_records(FILE* f, int framing) {
+  RecordReader* r;
+  struct stat st;
+  off_t off;
+
+  if ((r = (RecordReader*)calloc(1, sizeof(RecordReader))) == 0) exit(-1);
+  r->f = f;
+  r->framing = framing;
+
+  /* nothing is buffered in f at its start, or just after a seek */
+  if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode) && st.st_size && (off = ftello(f)) != -1) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      r->buf = (char*)map;
+      r->cap = r->end = st.st_size;
+      r->pos = off < st.st_size ? off : st.st_size;
+      r->mapped = r->eof = 1;
+      return r;
+    }
+  }
+  r->cap = RECORD_CHUNK;
+  if ((r->buf = (char*)malloc(r->cap)) == 0) exit(-1);
+  return r;
+}
+
+/* make at least want bytes available after pos, or as many as are left */
+static void fill(RecordReader* r, size_t want) {
+  size_t n;
+  if (r->eof) return;
+  if (r->pos) {
+    memmove(r->buf, r->buf + r->pos, r->end - r->pos);
+    r->end -= r->pos;
+    r->pos = 0;
+  }
+  if (want < r->end + RECORD_CHUNK / 2) want = r->end + RECORD_CHUNK / 2;
+  if (want > r->cap) {
+    while (r->cap < want) r->cap *= 2;
+    if ((r->buf = (char*)realloc(r->buf, r->cap)) == 0) exit(-1);
+  }
+  /* large freads go straight into buf, bypassing stdio's buffer */
+  while (r->end < want && !r->eof) {
+    n = fread(r->buf + r->end, 1, r->cap - r->end, r->f);
+    r->end += n;
+    if (!n) r->eof = 1;
+  }
+}
+
+int next_record(RecordReader* r, char const** rec, size_t* len) {
+  char const* delim;
+  size_t avail, scanned = 0;
+
+  if (r->framing == FRAME_LEN32) {
+    unsigned char const* p;
+    uint32_t n;
+    if (r->end - r->pos < 4) fill(r, 4);
+    if ((avail = r->end - r->pos) == 0) return 0;
+    if (avail < 4) goto truncated;
+    p = (unsigned char const*)r->buf + r->pos;
+    n = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    if (avail - 4 < n) fill(r, 4 + (size_t)n);
+    if (r->end - r->pos - 4 < n) goto truncated;
+    *rec = r->buf + r->pos + 4;
+    *len = n;
+    r->consumed = 4 + (size_t)n;
+    r->pos += r->consumed;
+    return 1;
+  }
+
+  for (;;) {
+    avail = r->end - r->pos;
+    if ((delim = (char const*)memchr(r->buf + r->pos + scanned, r->framing == FRAME_NUL ? '\0' : '\n',
+                                     avail - scanned))) {
+      *rec = r->buf + r->pos;
+      *len = delim - *rec;
+      r->consumed = *len + 1;
+      break;
+    }
+    if (r->eof) {
+      /* a last record without a delimiter */
+      if (!avail) return 0;
+      *rec = r->buf + r->pos;
+      *len = r->consumed = avail;
+      break;
+    }
+    scanned = avail;
+    fill(r, avail + 1);
+  }
+  r->pos += r->consumed;
+  return 1;
+
+truncated:
+  fprintf(stderr, "ERROR: input ends inside a length-prefixed record\n");
+  exit(-1);
+}
+
+void write_record(FILE* f, int framing, char const* rec, size_t len) {
+  unsigned char n[4];
+  if (framing == FRAME_LEN32) {
+    n[0] = len;
+    n[1] = len >> 8;
+    n[2] = len >> 16;
+    n[3] = len >> 24;
+    fwrite(n, 1, 4, f);
+  }
+  fwrite(rec, 1, len, f);
+  if (framing != FRAME_LEN32) putc(framing == FRAME_NUL ? '\0' : '\n', f);
+}
+
+void close_records(RecordReader* r) {
+  if (r->mapped)
+    munmap(r->buf, r->cap);
+  else
+    free(r->buf);
+  free(r);
+}
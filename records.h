@@ -0,0 +1,33 @@
+#ifndef _RECORDS_H
+#define _RECORDS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Binary-safe record input: newline- or NUL-delimited records, or records
+ * each preceded by their length as a 4-byte little-endian integer. Records
+ * are returned in place - from an mmap of the input when it's a regular
+ * file, otherwise from a large read buffer - so they may contain any bytes.
+ */
+
+enum { FRAME_NEWLINE, FRAME_NUL, FRAME_LEN32 };
+
+typedef struct {
+  FILE* f;
+  int framing;
+  char* buf; /* unconsumed input is buf[pos..end) */
+  size_t cap, pos, end;
+  int mapped, eof;
+  size_t consumed; /* input bytes taken by the last record, framing included */
+} RecordReader;
+
+/** read records from f's current position */
+extern RecordReader* open_records(FILE*, int framing);
+/** the next record (without its delimiter or length prefix) in *rec and
+    *len, valid until the next call; 0 at end of input */
+extern int next_record(RecordReader*, char const** rec, size_t* len);
+extern void close_records(RecordReader*);
+/** write rec in the given framing, so that records can be read back */
+extern void write_record(FILE*, int framing, char const* rec, size_t len);
+
+#endif
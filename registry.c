@@ -0,0 +1,312 @@
+/*
+ * Shared, reference-counted models with per-thread contexts; see registry.h
+ */
+
+#include "registry.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct Context Context;
+
+/* a thread's contexts, across models and registries */
+typedef struct {
+  Context* head;
+} ThreadContexts;
+
+struct Context {
+  ThreadContexts* owner;  /* NULL once its thread has exited */
+  LanguageIdentifier* lid;
+  Context* next;          /* the model's */
+  Context *tprev, *tnext; /* the owner's */
+};
+
+struct LangidModel {
+  LangidRegistry* r;
+  char* key;               /* real path, or "" */
+  LanguageIdentifier* lid; /* NULL while loading */
+  uint64_t serial;         /* unique to this load, for the context cache */
+  unsigned refs;
+  uint64_t released; /* when refs last went to 0 */
+  size_t bytes;      /* model_size, plus the contexts' scratch */
+  Context* contexts;
+  struct LangidModel* next;
+};
+
+typedef struct Alias {
+  char *name, *path;
+  struct Alias* next;
+} Alias;
+
+struct LangidRegistry {
+  pthread_mutex_t lock;
+  pthread_cond_t loaded;
+  size_t max_bytes;
+  LangidModel* models;
+  Alias* aliases;
+  uint64_t clock;
+  RegistryStats stats;
+};
+
+/* serials are unique across registries, as the cache is per thread */
+static uint64_t model_serial;
+
+/* guards every model's contexts and every thread's list of them */
+static pthread_mutex_t context_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+/* thread exit: its contexts stay with their models for other threads */
+static void release_contexts(void* p) {
+  ThreadContexts* t = (ThreadContexts*)p;
+  Context* c;
+  pthread_mutex_lock(&context_lock);
+  for (c = t->head; c; c = c->tnext) c->owner = NULL;
+  pthread_mutex_unlock(&context_lock);
+  free(t);
+}
+
+static void create_thread_key(void) { pthread_key_create(&thread_key, release_contexts); }
+
+static ThreadContexts* thread_contexts(void) {
+  ThreadContexts* t;
+  pthread_once(&thread_once, create_thread_key);
+  if ((t = (ThreadContexts*)pthread_getspecific(thread_key))) return t;
+  if ((t = (ThreadContexts*)calloc(1, sizeof(ThreadContexts))) == 0) exit(-1);
+  pthread_setspecific(thread_key, t);
+  return t;
+}
+
+/* with context_lock held */
+static void set_owner(Context* c, ThreadContexts* t) {
+  c->owner = t;
+  c->tprev = NULL;
+  if ((c->tnext = t->head)) c->tnext->tprev = c;
+  t->head = c;
+}
+
+/* with context_lock held */
+static void unlink_owner(Context* c) {
+  if (!c->owner) return;
+  if (c->tprev)
+    c->tprev->tnext = c->tnext;
+  else
+    c->owner->head = c->tnext;
+  if (c->tnext) c->tnext->tprev = c->tprev;
+  c->owner = NULL;
+}
+
+/* each thread's most recent contexts, by model serial (never 0) */
+#define CONTEXT_CACHE 4
+static __thread struct {
+  uint64_t serial;
+  LanguageIdentifier* lid;
+} context_cache[CONTEXT_CACHE];
+
+static char* copy_string(char const* s) {
+  char* c;
+  if ((c = strdup(s)) == 0) exit(-1);
+  return c;
+}
+
+LangidRegistry* create_registry(size_t max_bytes) {
+  LangidRegistry* r;
+  if ((r = (LangidRegistry*)calloc(1, sizeof(LangidRegistry))) == 0) exit(-1);
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->loaded, NULL);
+  r->max_bytes = max_bytes;
+  return r;
+}
+
+static void unload(LangidModel* m) {
+  Context *c, *next;
+  pthread_mutex_lock(&context_lock);
+  for (c = m->contexts; c; c = c->next) unlink_owner(c);
+  pthread_mutex_unlock(&context_lock);
+  /* clones go before the original */
+  for (c = m->contexts; c; c = next) {
+    next = c->next;
+    if (c->lid != m->lid) destroy_identifier(c->lid);
+    free(c);
+  }
+  destroy_identifier(m->lid);
+  free(m->key);
+  free(m);
+}
+
+void destroy_registry(LangidRegistry* r) {
+  LangidModel *m, *next;
+  Alias *a, *anext;
+  for (m = r->models; m; m = next) {
+    next = m->next;
+    unload(m);
+  }
+  for (a = r->aliases; a; a = anext) {
+    anext = a->next;
+    free(a->name);
+    free(a->path);
+    free(a);
+  }
+  pthread_cond_destroy(&r->loaded);
+  pthread_mutex_destroy(&r->lock);
+  free(r);
+}
+
+/* the key for a model file; NULL if it can't be read */
+static char* model_key(char const* path) {
+  char* key;
+  if (!*path) return copy_string("");
+  if (access(path, R_OK) || (key = realpath(path, NULL)) == 0) return NULL;
+  return key;
+}
+
+int registry_add(LangidRegistry* r, char const* name, char const* path) {
+  Alias* a;
+  char* key;
+  if ((key = model_key(path)) == 0) return 0;
+  pthread_mutex_lock(&r->lock);
+  for (a = r->aliases; a && strcmp(a->name, name); a = a->next)
+    ;
+  if (a)
+    free(a->path);
+  else {
+    if ((a = (Alias*)malloc(sizeof(Alias))) == 0) exit(-1);
+    a->name = copy_string(name);
+    a->next = r->aliases;
+    r->aliases = a;
+  }
+  a->path = key;
+  pthread_mutex_unlock(&r->lock);
+  return 1;
+}
+
+/* unload idle models, least recently released first, until under the cap */
+static void evict(LangidRegistry* r) {
+  LangidModel **p, **victim, *m;
+  while (r->max_bytes && r->stats.bytes > r->max_bytes) {
+    victim = NULL;
+    for (p = &r->models; *p; p = &(*p)->next)
+      if (!(*p)->refs && (*p)->lid && (!victim || (*p)->released < (*victim)->released)) victim = p;
+    if (!victim) return;
+    r->stats.bytes -= (*victim)->bytes;
+    r->stats.models--;
+    r->stats.evictions++;
+    m = *victim;
+    *victim = m->next;
+    unload(m);
+  }
+}
+
+LangidModel* registry_acquire(LangidRegistry* r, char const* name) {
+  LangidModel* m;
+  LanguageIdentifier* lid;
+  Alias* a;
+  char* key;
+
+  if (!name) name = "";
+  pthread_mutex_lock(&r->lock);
+  for (a = r->aliases; a && strcmp(a->name, name); a = a->next)
+    ;
+  key = a ? copy_string(a->path) : model_key(name);
+  if (!key) {
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+  }
+  for (m = r->models; m && strcmp(m->key, key); m = m->next)
+    ;
+  if (m) {
+    free(key);
+    if (!m->refs++) r->stats.held++;
+    while (!m->lid) pthread_cond_wait(&r->loaded, &r->lock);
+    pthread_mutex_unlock(&r->lock);
+    return m;
+  }
+
+  /* load without the lock, so other models stay available meanwhile */
+  if ((m = (LangidModel*)calloc(1, sizeof(LangidModel))) == 0) exit(-1);
+  m->r = r;
+  m->key = key;
+  m->serial = __atomic_add_fetch(&model_serial, 1, __ATOMIC_RELAXED);
+  m->refs = 1;
+  m->next = r->models;
+  r->models = m;
+  r->stats.held++;
+  pthread_mutex_unlock(&r->lock);
+
+  lid = *key ? load_identifier(key) : get_default_identifier();
+
+  pthread_mutex_lock(&r->lock);
+  m->lid = lid;
+  m->bytes = model_size(lid) + scratch_size(lid);
+  r->stats.bytes += m->bytes;
+  r->stats.models++;
+  r->stats.loads++;
+  pthread_cond_broadcast(&r->loaded);
+  evict(r);
+  pthread_mutex_unlock(&r->lock);
+  return m;
+}
+
+void registry_release(LangidRegistry* r, LangidModel* m) {
+  pthread_mutex_lock(&r->lock);
+  if (!--m->refs) {
+    r->stats.held--;
+    m->released = ++r->clock;
+    evict(r);
+  }
+  pthread_mutex_unlock(&r->lock);
+}
+
+LanguageIdentifier* model_context(LangidModel* m) {
+  LangidRegistry* r = m->r;
+  unsigned slot = m->serial % CONTEXT_CACHE;
+  ThreadContexts* self;
+  LanguageIdentifier* lid;
+  Context* c;
+  size_t scratch = 0;
+
+  if (context_cache[slot].serial == m->serial) return context_cache[slot].lid;
+  self = thread_contexts();
+  pthread_mutex_lock(&context_lock);
+  for (c = m->contexts; c && c->owner != self; c = c->next)
+    ;
+  /* else one left by a thread that has exited */
+  if (!c) {
+    for (c = m->contexts; c && c->owner; c = c->next)
+      ;
+    if (c) set_owner(c, self);
+  }
+  if (!c) {
+    if ((c = (Context*)malloc(sizeof(Context))) == 0) exit(-1);
+    /* the first thread scores with the model's own identifier */
+    if (m->contexts) {
+      c->lid = clone_identifier(m->lid);
+      scratch = scratch_size(m->lid);
+    } else
+      c->lid = m->lid;
+    c->next = m->contexts;
+    m->contexts = c;
+    set_owner(c, self);
+  }
+  lid = c->lid;
+  pthread_mutex_unlock(&context_lock);
+  if (scratch) {
+    pthread_mutex_lock(&r->lock);
+    m->bytes += scratch;
+    r->stats.bytes += scratch;
+    pthread_mutex_unlock(&r->lock);
+  }
+  context_cache[slot].serial = m->serial;
+  context_cache[slot].lid = lid;
+  return lid;
+}
+
+char const* model_name(LangidModel const* m) { return m->key; }
+
+void registry_stats(LangidRegistry* r, RegistryStats* s) {
+  pthread_mutex_lock(&r->lock);
+  *s = r->stats;
+  pthread_mutex_unlock(&r->lock);
+}
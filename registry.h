@@ -0,0 +1,51 @@
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+#include "liblangid.h"
+#include <stddef.h>
+
+/* A process-wide registry of models shared by many callers: each model is
+ * loaded once, on first acquire, however many names or paths lead to it
+ * (models are keyed by their real path; "" is the built-in one), and
+ * reference counted. Released models stay loaded until the registry's
+ * bytes exceed its cap, when the least recently released idle ones are
+ * unloaded. A model in use is never unloaded, so the cap can be exceeded
+ * while callers hold more than it allows.
+ *
+ * Threads score with model_context, which gives each thread its own
+ * clone_identifier of a model, made on its first call. When a thread exits
+ * its contexts pass to the next threads to call for them, so a model has
+ * as many as threads have used it at once, until it is unloaded. Contexts
+ * count towards the registry's bytes.
+ */
+
+typedef struct LangidRegistry LangidRegistry;
+typedef struct LangidModel LangidModel;
+
+typedef struct {
+  size_t bytes;     /* of the loaded models and their contexts */
+  unsigned models;  /* loaded */
+  unsigned held;    /* of those, acquired and not yet released */
+  size_t loads, evictions;
+} RegistryStats;
+
+/** max_bytes 0: no cap */
+extern LangidRegistry* create_registry(size_t max_bytes);
+/** every model must have been released */
+extern void destroy_registry(LangidRegistry*);
+/** name a model file for registry_acquire (path "" is the built-in model);
+    0 if it can't be read */
+extern int registry_add(LangidRegistry*, char const* name, char const* path);
+/** the model registered as name, or else at path name, loading it if need
+    be (other callers wait for a load in progress rather than repeat it);
+    NULL or "" is the built-in model. NULL if the file can't be read */
+extern LangidModel* registry_acquire(LangidRegistry*, char const* name);
+extern void registry_release(LangidRegistry*, LangidModel*);
+/** the calling thread's identifier for the model, valid while the model is
+    held; use it from this thread only */
+extern LanguageIdentifier* model_context(LangidModel*);
+/** the model's real path, or "" if built in */
+extern char const* model_name(LangidModel const*);
+extern void registry_stats(LangidRegistry*, RegistryStats*);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Many threads sharing models through a registry (registry.h):
+ *
+ *   registrybench [-m name=path]... [-t threads] [-n requests] [-d docs] [-c MB] < corpus
+ *
+ * each request acquires a model picked at random (skewed towards the first
+ * named), identifies d corpus lines with the thread's context for it, and
+ * releases it. Labels are checked against each model loaded on its own,
+ * and the time taken is compared with loading the model for every request,
+ * which is what callers without a registry would do.
+ */
+
+#include "registry.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+char const* getoptspec = "hm:t:n:d:c:";
+
+void usage() {
+  printf("registrybench [-m name=path]... [-t threads] [-n requests] [-d docs] [-c MB] < corpus (%s)\n"
+         "\n -m: a model to register (path empty for the built-in one; default just that)"
+         "\n -t: threads (default 4)"
+         "\n -n: requests per thread (default 2000)"
+         "\n -d: documents per request (default 16)"
+         "\n -c: the registry's cap in MB (default none)"
+         "\n\n",
+         getoptspec);
+}
+
+#define MAX_MODELS 16
+
+static char* names[MAX_MODELS];
+static char* paths[MAX_MODELS];
+static unsigned num_models;
+static char** lines;
+static unsigned* lens;
+static size_t num_lines;
+static LangIndex* expected[MAX_MODELS];
+static LangidRegistry* registry;
+static unsigned long requests = 2000, docs = 16;
+static unsigned long differ;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_rand(uint64_t* s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545f4914f6cdd1dull;
+}
+
+/* model k with weight 1/(k+1) */
+static unsigned pick(uint64_t* s) {
+  double total = 0, x;
+  unsigned k;
+  for (k = 0; k < num_models; k++) total += 1.0 / (k + 1);
+  x = (next_rand(s) >> 11) * 0x1p-53 * total;
+  for (k = 0; k + 1 < num_models && (x -= 1.0 / (k + 1)) >= 0; k++)
+    ;
+  return k;
+}
+
+static void* worker(void* arg) {
+  uint64_t s = 0x9e3779b97f4a7c15ull * ((size_t)arg + 1);
+  unsigned long i, j, bad = 0;
+  LanguageIdentifier* lid;
+  LangidModel* m;
+  size_t line;
+  unsigned k;
+
+  for (i = 0; i < requests; i++) {
+    k = pick(&s);
+    if (!(m = registry_acquire(registry, names[k]))) {
+      fprintf(stderr, "can't acquire %s\n", names[k]);
+      exit(1);
+    }
+    lid = model_context(m);
+    for (j = 0; j < docs; j++) {
+      line = next_rand(&s) % num_lines;
+      bad += identify_index(lid, lines[line], lens[line]) != expected[k][line];
+    }
+    registry_release(registry, m);
+  }
+  __atomic_add_fetch(&differ, bad, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  unsigned threads = 4, t, k;
+  size_t cap = 0, line_size = 0, alloc = 0, i;
+  char *line = NULL, *eq;
+  double load_time[MAX_MODELS], elapsed, weight = 0, mean_load = 0;
+  LanguageIdentifier* lid;
+  RegistryStats stats;
+  pthread_t* tids;
+  ssize_t len;
+  int c;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'm':
+      if (num_models == MAX_MODELS || !(eq = strchr(optarg, '='))) {
+        usage();
+        return 1;
+      }
+      *eq = 0;
+      names[num_models] = optarg;
+      paths[num_models++] = eq + 1;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'n':
+      requests = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      docs = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      cap = strtoul(optarg, NULL, 10) << 20;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+  if (!num_models) {
+    names[0] = "builtin";
+    paths[num_models++] = "";
+  }
+  if (!threads) threads = 1;
+
+  while ((len = getline(&line, &line_size, stdin)) > 0) {
+    if (line[len - 1] == '\n') line[--len] = 0;
+    if (num_lines == alloc) {
+      alloc = alloc ? 2 * alloc : 1024;
+      if ((lines = (char**)realloc(lines, alloc * sizeof(char*))) == 0) exit(-1);
+      if ((lens = (unsigned*)realloc(lens, alloc * sizeof(unsigned))) == 0) exit(-1);
+    }
+    if ((lines[num_lines] = strdup(line)) == 0) exit(-1);
+    lens[num_lines++] = len;
+  }
+  if (!num_lines) {
+    fprintf(stderr, "no corpus lines on stdin\n");
+    return 1;
+  }
+
+  registry = create_registry(cap);
+  for (k = 0; k < num_models; k++) {
+    if (!registry_add(registry, names[k], paths[k])) {
+      fprintf(stderr, "can't read %s\n", paths[k]);
+      return 1;
+    }
+    /* what each model says on its own */
+    load_time[k] = now();
+    lid = *paths[k] ? load_identifier(paths[k]) : get_default_identifier();
+    load_time[k] = now() - load_time[k];
+    if ((expected[k] = (LangIndex*)malloc(num_lines * sizeof(LangIndex))) == 0) exit(-1);
+    for (i = 0; i < num_lines; i++) expected[k][i] = identify_index(lid, lines[i], lens[i]);
+    printf("%-12s %u langs, %8.1f MB, loads in %.3f s\n", names[k], lid->num_langs, model_size(lid) / 1048576.0,
+           load_time[k]);
+    destroy_identifier(lid);
+  }
+
+  if ((tids = (pthread_t*)malloc(threads * sizeof(pthread_t))) == 0) exit(-1);
+  elapsed = now();
+  for (t = 0; t < threads; t++) pthread_create(&tids[t], NULL, worker, (void*)(size_t)t);
+  for (t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+  elapsed = now() - elapsed;
+  registry_stats(registry, &stats);
+
+  for (k = 0; k < num_models; k++) mean_load += load_time[k] / (k + 1);
+  for (k = 0; k < num_models; k++) weight += 1.0 / (k + 1);
+  mean_load /= weight;
+  printf("%u threads, %lu requests of %lu documents in %.3f s: %.0f requests/s\n", threads, threads * requests, docs,
+         elapsed, threads * requests / elapsed);
+  printf("%zu loads, %zu evictions; %u models, %.1f MB loaded at the end\n", stats.loads, stats.evictions,
+         stats.models, stats.bytes / 1048576.0);
+  printf("loading per request instead would add about %.1f s\n", threads * requests * mean_load);
+  printf("%lu labels differ\n", differ);
+
+  destroy_registry(registry);
+  return differ != 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Producer side of the shared-memory ring service; see ring.h
+ */
+
+#include "ring.h"
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+size_t ring_map_size(uint64_t data_size, uint64_t comp_size) {
+  return sizeof(RingHeader) + data_size + comp_size * sizeof(RingCompletion);
+}
+
+/* shared (not FUTEX_PRIVATE) futexes, as the waiters are in two processes */
+void futex_wait_u32(uint32_t* addr, uint32_t val) { syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0); }
+
+void futex_wake_u32(uint32_t* addr, int n) { syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0); }
+
+LangidRing* ring_attach(char const* name) {
+  LangidRing* r;
+  RingHeader* h;
+  char const* p;
+  unsigned i;
+  int fd;
+
+  if ((fd = shm_open(name, O_RDWR, 0)) == -1) return NULL;
+  h = (RingHeader*)mmap(NULL, sizeof(RingHeader), PROT_READ, MAP_SHARED, fd, 0);
+  if (h == MAP_FAILED || memcmp(h->magic, RING_MAGIC, 8)) {
+    close(fd);
+    return NULL;
+  }
+  while (!__atomic_load_n(&h->ready, __ATOMIC_ACQUIRE)) usleep(1000);
+  if ((r = (LangidRing*)calloc(1, sizeof(LangidRing))) == 0) exit(-1);
+  r->map_size = ring_map_size(h->data_size, h->comp_size);
+  munmap(h, sizeof(RingHeader));
+  h = (RingHeader*)mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (h == MAP_FAILED) {
+    free(r);
+    return NULL;
+  }
+  r->h = h;
+  r->data = (char*)(h + 1);
+  r->comp = (RingCompletion*)(r->data + h->data_size);
+  r->head = h->head;
+  r->submitted = h->comp_tail;
+  for (p = h->langs, i = 0; i < h->num_langs && i < 256; i++, p += strlen(p) + 1) r->names[i] = p;
+  return r;
+}
+
+void ring_detach(LangidRing* r) {
+  munmap(r->h, r->map_size);
+  free(r);
+}
+
+/* does a record of need bytes fit at the head? *pad is the padding it
+ * takes first */
+static int fits(LangidRing* r, uint64_t need, uint64_t* pad) {
+  RingHeader* h = r->h;
+  uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE), off = r->head & (h->data_size - 1);
+  *pad = off + need > h->data_size ? h->data_size - off : 0;
+  return r->head + *pad + need - tail <= h->data_size;
+}
+
+char* ring_reserve(LangidRing* r, uint32_t len) {
+  RingHeader* h = r->h;
+  uint64_t need = RING_RECORD_SIZE(len), off, pad;
+  RingRecord* rec;
+
+  if (need > h->data_size / 2) return NULL;
+  /* a completion slot for every document in flight */
+  if (r->submitted - __atomic_load_n(&h->comp_tail, __ATOMIC_RELAXED) >= h->comp_size) return NULL;
+  if (!fits(r, need, &pad)) return NULL;
+  off = r->head & (h->data_size - 1);
+  if (pad) {
+    /* the service skips (and reclaims) the rest of the ring */
+    rec = (RingRecord*)(r->data + off);
+    rec->len = RING_SKIP;
+    rec->done = 0;
+    rec->flags = 0;
+    rec->tag = pad;
+    r->head += pad;
+    off = 0;
+  }
+  rec = (RingRecord*)(r->data + off);
+  return (char*)(rec + 1);
+}
+
+void ring_commit_flags(LangidRing* r, uint64_t tag, uint32_t len, unsigned flags) {
+  RingRecord* rec = (RingRecord*)(r->data + (r->head & (r->h->data_size - 1)));
+  rec->len = len;
+  rec->done = 0;
+  rec->flags = flags;
+  rec->tag = tag;
+  r->head += RING_RECORD_SIZE(len);
+  /* only a document's last record gets a completion */
+  if (!(r->partial = (flags & RING_MORE) != 0)) ++r->submitted;
+  __atomic_store_n(&r->h->head, r->head, __ATOMIC_RELEASE);
+}
+
+void ring_commit(LangidRing* r, uint64_t tag, uint32_t len) { ring_commit_flags(r, tag, len, 0); }
+
+int ring_submit(LangidRing* r, uint64_t tag, char const* text, uint32_t len) {
+  char* p = ring_reserve(r, len);
+  if (!p) return 0;
+  memcpy(p, text, len);
+  ring_commit(r, tag, len);
+  return 1;
+}
+
+size_t ring_submit_chunks(LangidRing* r, uint64_t tag, char const* text, size_t len) {
+  size_t done = 0, n;
+  char* p;
+  while (done < len) {
+    n = len - done < RING_CHUNK ? len - done : RING_CHUNK;
+    if (!(p = ring_reserve(r, n))) break;
+    memcpy(p, text + done, n);
+    done += n;
+    ring_commit_flags(r, tag, n, RING_BULK | (done < len ? RING_MORE : 0));
+  }
+  return done;
+}
+
+void ring_flush(LangidRing* r) {
+  RingHeader* h = r->h;
+  __atomic_add_fetch(&h->sub_seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->workers_waiting, __ATOMIC_SEQ_CST)) futex_wake_u32(&h->sub_seq, 1 << 30);
+}
+
+unsigned ring_poll(LangidRing* r, RingCompletion* out, unsigned max) {
+  RingHeader* h = r->h;
+  uint64_t tail = h->comp_tail, head = __atomic_load_n(&h->comp_head, __ATOMIC_ACQUIRE);
+  unsigned n = 0;
+  for (; tail < head && n < max; ++tail) out[n++] = r->comp[tail & (h->comp_size - 1)];
+  __atomic_store_n(&h->comp_tail, tail, __ATOMIC_RELEASE);
+  return n;
+}
+
+unsigned ring_wait(LangidRing* r, RingCompletion* out, unsigned max) {
+  RingHeader* h = r->h;
+  unsigned n;
+  uint32_t seq;
+  uint64_t pad;
+  ring_flush(r);
+  for (;;) {
+    /* the service bumps comp_seq after every reclaim, completion or not */
+    seq = __atomic_load_n(&h->comp_seq, __ATOMIC_SEQ_CST);
+    if ((n = ring_poll(r, out, max)) || (h->comp_tail == r->submitted && !r->partial)) return n;
+    /* a chunked document continues as soon as its next chunk fits, which
+     * it may already (the service can take chunks before any flush) */
+    if (r->partial && fits(r, RING_RECORD_SIZE(RING_CHUNK), &pad)) return 0;
+    __atomic_add_fetch(&h->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->comp_head, __ATOMIC_SEQ_CST) == h->comp_tail) futex_wait_u32(&h->comp_seq, seq);
+    __atomic_sub_fetch(&h->producer_waiting, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+void ring_close(LangidRing* r) {
+  __atomic_store_n(&r->h->closed, 1, __ATOMIC_RELEASE);
+  ring_flush(r);
+  futex_wake_u32(&r->h->sub_seq, 1 << 30);
+}
+
+char const* ring_lang_name(LangidRing* r, int32_t lang) {
+  return lang >= 0 && (uint32_t)lang < r->h->num_langs && lang < 256 ? r->names[lang] : NULL;
+}
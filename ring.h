@@ -0,0 +1,133 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shared-memory ring service (langid -R name): a same-host producer writes
+ * documents straight into a submission ring in /dev/shm/name, langid
+ * worker threads identify them in place, and the results come back
+ * through a completion ring. Waiting is done on futexes in the shared
+ * mapping, and only when a side actually has nothing to do, so a busy
+ * producer and service exchange documents without system calls.
+ *
+ * One producer process per ring. Submission positions are byte offsets
+ * that only grow; records are 16-byte aligned and never wrap (a skip
+ * record pads to the end of the ring instead).
+ *
+ * Documents are interactive or bulk: interactive if flagged
+ * RING_INTERACTIVE, or if unflagged and at most RING_INTERACTIVE_MAX bytes
+ * in a single record. The service queues the classes separately, keeps
+ * some workers for interactive documents only, and identifies bulk
+ * documents a slice at a time, taking interactive work in between. A bulk
+ * document larger than the ring goes in as chunks (ring_submit_chunks):
+ * records under one tag flagged RING_MORE, up to the last, which completes
+ * the whole document.
+ */
+
+#define RING_MAGIC "LIDRING2"
+#define RING_LANGS_SIZE 2048
+#ifndef RING_DATA_SIZE
+#define RING_DATA_SIZE (32u << 20)
+#endif
+/* completion entries; also the limit on documents in flight */
+#define RING_COMP_SIZE (RING_DATA_SIZE / 32)
+
+typedef struct {
+  char magic[8];
+  uint32_t ready;  /* set by the service once it is serving */
+  uint32_t closed; /* set by the producer: nothing more will be submitted */
+  uint64_t data_size, comp_size;
+  uint32_t num_langs;
+  char langs[RING_LANGS_SIZE]; /* NUL-terminated language names */
+
+  /* written by the producer */
+  uint64_t head __attribute__((aligned(64))); /* bytes committed */
+  uint32_t sub_seq;                           /* futex: bumped by ring_flush */
+  uint32_t workers_waiting;
+
+  /* written by the service */
+  uint64_t tail __attribute__((aligned(64))); /* bytes reclaimed */
+  uint64_t comp_head;                         /* completions posted */
+  uint32_t comp_seq;                          /* futex: bumped with comp_head */
+  uint32_t producer_waiting;
+
+  /* written by the producer */
+  uint64_t comp_tail __attribute__((aligned(64))); /* completions consumed */
+} RingHeader;
+
+#define RING_SKIP 0xffffffffu
+
+/* RingRecord flags */
+#define RING_INTERACTIVE 1
+#define RING_BULK 2
+#define RING_MORE 4 /* the document continues in the next record of its tag */
+#ifndef RING_INTERACTIVE_MAX
+#define RING_INTERACTIVE_MAX (16u << 10)
+#endif
+/* ring_submit_chunks' chunk size */
+#define RING_CHUNK (1u << 20)
+
+typedef struct {
+  uint32_t len; /* of the text that follows, or RING_SKIP */
+  uint16_t done;
+  uint16_t flags;
+  uint64_t tag;
+} RingRecord;
+
+typedef struct {
+  uint64_t tag;
+  int32_t lang; /* index into the ring's language names */
+  uint32_t len; /* of the whole document */
+} RingCompletion;
+
+#define RING_RECORD_SIZE(len) ((sizeof(RingRecord) + (uint64_t)(len) + 15) & ~(uint64_t)15)
+
+typedef struct {
+  RingHeader* h;
+  char* data;
+  RingCompletion* comp;
+  size_t map_size;
+  char const* names[256];
+  uint64_t head, submitted; /* producer-local copies */
+  int partial;              /* the last record committed was RING_MORE */
+} LangidRing;
+
+/* layout helpers shared with the service */
+extern size_t ring_map_size(uint64_t data_size, uint64_t comp_size);
+extern void futex_wait_u32(uint32_t* addr, uint32_t val);
+extern void futex_wake_u32(uint32_t* addr, int n);
+
+/* producer API */
+
+/** attach to the service's ring, waiting for it to be ready; NULL if none */
+extern LangidRing* ring_attach(char const* name);
+extern void ring_detach(LangidRing*);
+/** space for a document of up to len bytes, to be filled and then
+    ring_commit'ed; NULL if there is no room until completions are read */
+extern char* ring_reserve(LangidRing*, uint32_t len);
+/** submit the reserved document (len <= the reserved len) under tag. the
+    service isn't woken until ring_flush, so commit a batch, then flush */
+extern void ring_commit(LangidRing*, uint64_t tag, uint32_t len);
+/** ring_commit with RingRecord flags (RING_INTERACTIVE, RING_BULK,
+    RING_MORE) */
+extern void ring_commit_flags(LangidRing*, uint64_t tag, uint32_t len, unsigned flags);
+/** reserve, copy and commit; 0 if there is no room */
+extern int ring_submit(LangidRing*, uint64_t tag, char const* text, uint32_t len);
+/** submit as much of a bulk document of any (nonzero) size as there is
+    room for, in chunks of up to RING_CHUNK; returns the bytes taken. call
+    again with the rest (ring_wait in between if none were taken) until the
+    whole document is taken */
+extern size_t ring_submit_chunks(LangidRing*, uint64_t tag, char const* text, size_t len);
+extern void ring_flush(LangidRing*);
+/** up to max completions without waiting */
+extern unsigned ring_poll(LangidRing*, RingCompletion* out, unsigned max);
+/** flush, then wait for at least one completion; 0 if none are pending.
+    while a chunked document is part-submitted, also 0 as soon as there
+    is room for its next chunk (its earlier chunks post no completions) */
+extern unsigned ring_wait(LangidRing*, RingCompletion* out, unsigned max);
+/** tell the service to exit once everything submitted is done */
+extern void ring_close(LangidRing*);
+extern char const* ring_lang_name(LangidRing*, int32_t lang);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Producer for the shared-memory ring service, for benchmarking it:
+ *
+ *   langid -R /langid -w 2 &
+ *   ringbench -R /langid -n 1000000 -s 40 < sample.txt
+ *
+ * submits -n documents of -s bytes (cut from the lines of stdin) and reports
+ * documents per second and a checksum of the languages. With -e, every e+1st
+ * document is instead a bulk one of -B bytes (the lines of stdin run
+ * together), submitted in chunks; then the latency percentiles of each
+ * class are reported too (use -b 1, or batching adds to them).
+ */
+
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+char const *getoptspec = "hR:n:s:b:e:B:v";
+
+void usage() {
+  printf("ringbench -R name [-n docs] [-s size] [-b batch] [-e every] [-B "
+         "bulk] [-v] (%s)\n"
+         "\n -R: ring name given to langid -R"
+         "\n -n: documents to submit (default 1000000)"
+         "\n -s: bytes per document (default: each line of stdin)"
+         "\n -b: documents committed per flush (default 256)"
+         "\n -e: a bulk document after every e others (default: none)"
+         "\n -B: bytes per bulk document (default 8388608)"
+         "\n -v: print each document's language"
+         "\n\n",
+         getoptspec);
+}
+
+#define MAX_COMPLETIONS 4096
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int by_value(void const *a, void const *b) {
+  uint64_t x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report_latency(char const *what, uint64_t *ns, unsigned long n) {
+  if (!n)
+    return;
+  qsort(ns, n, sizeof(uint64_t), by_value);
+  fprintf(stderr, "%s: %lu documents, latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+          what, n, ns[n / 2] / 1e3, ns[(n * 99 + 99) / 100 - 1] / 1e3, ns[n - 1] / 1e3);
+}
+
+int main(int argc, char **argv) {
+  int c, verbose = 0;
+  char *name = NULL, *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  unsigned long n = 1000000, size = 0, batch = 256, i, done = 0, sum = 0, k;
+  unsigned long every = 0, nlat[2] = {0, 0};
+  char **docs = NULL, *bulk = NULL;
+  size_t *lens = NULL, ndocs = 0, cap = 0, bulk_size = 8u << 20, bulk_left = 0, j, m;
+  uint64_t *sent, *lat[2], bulk_tag = 0;
+  LangidRing *ring;
+  RingCompletion comp[MAX_COMPLETIONS];
+  struct timespec t0, t1;
+  int progress;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'R':
+      name = optarg;
+      break;
+    case 'n':
+      n = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      batch = strtoul(optarg, NULL, 10);
+      break;
+    case 'e':
+      every = strtoul(optarg, NULL, 10);
+      break;
+    case 'B':
+      bulk_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage();
+      return c != 'h';
+    }
+  if (!name) {
+    usage();
+    return 1;
+  }
+
+  while ((len = getline(&line, &line_size, stdin)) > 1) {
+    if (ndocs == cap) {
+      cap = cap ? 2 * cap : 1024;
+      docs = realloc(docs, cap * sizeof(char *));
+      lens = realloc(lens, cap * sizeof(size_t));
+    }
+    lens[ndocs] = size && (size_t)len > size ? size : (size_t)len - 1;
+    docs[ndocs] = strndup(line, lens[ndocs]);
+    ++ndocs;
+  }
+  if (!ndocs) {
+    fprintf(stderr, "no sample documents on stdin\n");
+    return 1;
+  }
+  if (every) {
+    if (!bulk_size || (bulk = malloc(bulk_size)) == 0) {
+      usage();
+      return 1;
+    }
+    for (j = 0, k = 0; j < bulk_size; j += m, k++) {
+      m = lens[k % ndocs] + 1 < bulk_size - j ? lens[k % ndocs] + 1 : bulk_size - j;
+      memcpy(bulk + j, docs[k % ndocs], m - 1);
+      bulk[j + m - 1] = '\n';
+    }
+  }
+  if ((sent = malloc(n * sizeof(uint64_t))) == 0 || (lat[0] = malloc(n * sizeof(uint64_t))) == 0 ||
+      (lat[1] = malloc(n * sizeof(uint64_t))) == 0)
+    exit(-1);
+  if (!(ring = ring_attach(name))) {
+    fprintf(stderr, "no ring service at %s\n", name);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < n || bulk_left;) {
+    /* commit a batch, then collect whatever has completed */
+    for (progress = 0, k = 0; k < batch; k++) {
+      if (bulk_left) {
+        /* finish the bulk document before the next one */
+        j = ring_submit_chunks(ring, bulk_tag, bulk + bulk_size - bulk_left, bulk_left);
+        progress |= j != 0;
+        if ((bulk_left -= j))
+          break;
+        continue;
+      }
+      if (i == n)
+        break;
+      sent[i] = now_ns();
+      if (every && i % (every + 1) == every) {
+        bulk_tag = i++;
+        bulk_left = bulk_size;
+        continue;
+      }
+      if (!ring_submit(ring, i, docs[i % ndocs], lens[i % ndocs]))
+        break;
+      progress = 1;
+      ++i;
+    }
+    unsigned got = progress ? (ring_flush(ring), ring_poll(ring, comp, MAX_COMPLETIONS))
+                            : ring_wait(ring, comp, MAX_COMPLETIONS);
+    uint64_t t = now_ns();
+    for (k = 0; k < got; k++) {
+      int b = every && comp[k].tag % (every + 1) == every;
+      lat[b][nlat[b]++] = t - sent[comp[k].tag];
+      sum += comp[k].lang;
+      if (verbose)
+        printf("%llu %s\n", (unsigned long long)comp[k].tag,
+               ring_lang_name(ring, comp[k].lang));
+    }
+    done += got;
+  }
+  while (done < n) {
+    unsigned got = ring_wait(ring, comp, MAX_COMPLETIONS);
+    uint64_t t = now_ns();
+    for (k = 0; k < got; k++) {
+      int b = every && comp[k].tag % (every + 1) == every;
+      lat[b][nlat[b]++] = t - sent[comp[k].tag];
+      sum += comp[k].lang;
+      if (verbose)
+        printf("%llu %s\n", (unsigned long long)comp[k].tag,
+               ring_lang_name(ring, comp[k].lang));
+    }
+    done += got;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ring_close(ring);
+  ring_detach(ring);
+
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  fprintf(stderr, "%lu documents in %.3f s: %.0f docs/s (checksum %lu)\n", n,
+          secs, n / secs, sum);
+  if (every) {
+    report_latency("interactive", lat[0], nlat[0]);
+    report_latency("bulk", lat[1], nlat[1]);
+  }
+  return 0;
+}
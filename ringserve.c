@@ -0,0 +1,494 @@
+/*
+ * Service side of the shared-memory ring (langid -R name); see ring.h
+ *
+ * Workers claim batches of records under one lock and sort them into two
+ * lanes: interactive records, and bulk jobs (one per document, holding its
+ * chunks and an identifier with its incremental state). Interactive work
+ * always goes first, and the first quarter of the workers (when there are
+ * at least two) take nothing else. A bulk job is fed RING_SLICE bytes at a
+ * time, and between slices its worker claims new records and runs any
+ * waiting interactive batch with its own clone_identifier, so no document
+ * holds up interactive ones for longer than a slice. Completions are posted
+ * and finished records reclaimed under another lock.
+ */
+
+#include "ringserve.h"
+#include "liblangid.h"
+#include "probes.h"
+#include "ring.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_BATCH 64
+#ifndef RING_SLICE
+#define RING_SLICE (32u << 10)
+#endif
+/* a lang for complete_batch: mark the record done, but post nothing */
+#define NO_COMPLETION (-1)
+
+enum { CLASS_INTERACTIVE, CLASS_BULK, NUM_CLASSES };
+static char const* const class_names[NUM_CLASSES] = {"interactive", "bulk"};
+
+/* claim-to-completion latencies: 8 buckets per power of two of ns */
+#define LATENCY_BUCKETS (62 * 8)
+typedef struct {
+  uint64_t n, max;
+  uint64_t count[LATENCY_BUCKETS];
+} Latency;
+
+typedef struct Job Job;
+struct Job {
+  uint64_t tag;
+  LanguageIdentifier* lid; /* the document's incremental state */
+  uint64_t* chunks;        /* claimed records chunks[first..n) */
+  unsigned first, n, cap;
+  uint64_t len, start;
+  int running, queued, last_claimed;
+  Job *next, *next_run;
+};
+
+typedef struct {
+  RingHeader* h;
+  char* data;
+  RingCompletion* comp;
+  uint64_t claim; /* next record to sort into a lane */
+  pthread_mutex_t lock, comp_lock;
+  pthread_cond_t cond;
+  int polling; /* a worker waits on the ring's futex; the rest on cond */
+  /* interactive lane: records and their claim times, [head, tail) mod cap */
+  uint64_t *ipos, *itime;
+  size_t ihead, itail, icap;
+  /* bulk lane */
+  Job *jobs, *run_head, *run_tail;
+  LanguageIdentifier* model;
+  LanguageIdentifier** spare; /* identifiers of finished jobs */
+  unsigned nspare, max_spare;
+} Ring;
+
+typedef struct {
+  Ring* ring;
+  LanguageIdentifier* lid;
+  int reserved; /* interactive only */
+  pthread_t thread;
+  Latency latency[NUM_CLASSES];
+} Worker;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static unsigned latency_bucket(uint64_t ns) {
+  unsigned e;
+  if (ns < 8) return ns;
+  e = 63 - __builtin_clzll(ns);
+  return (e - 2) * 8 + (ns >> (e - 3) & 7);
+}
+
+/* the upper end of bucket i */
+static double bucket_ns(unsigned i) {
+  if (i < 8) return i + 1;
+  return (double)(9 + i % 8) * (1ull << (i / 8 - 1));
+}
+
+static void add_latency(Latency* l, uint64_t ns) {
+  ++l->n;
+  ++l->count[latency_bucket(ns)];
+  if (ns > l->max) l->max = ns;
+}
+
+static double percentile_us(Latency const* l, double p) {
+  uint64_t rank = (uint64_t)(p * l->n + 0.999999), seen = 0;
+  unsigned i;
+  for (i = 0; i < LATENCY_BUCKETS && (seen += l->count[i]) < rank; i++)
+    ;
+  /* the bucket's upper end, but no more than the max seen */
+  return (i < LATENCY_BUCKETS && bucket_ns(i) < l->max ? bucket_ns(i) : l->max) / 1e3;
+}
+
+static RingRecord* record_at(Ring* r, uint64_t pos) {
+  return (RingRecord*)(r->data + (pos & (r->h->data_size - 1)));
+}
+
+static uint64_t record_size(RingRecord const* rec) {
+  return rec->len == RING_SKIP ? rec->tag : RING_RECORD_SIZE(rec->len);
+}
+
+/* reclaim from the tail as far as records are done (other workers may
+ * still hold earlier ones); comp_lock held */
+static void reclaim(Ring* r) {
+  RingHeader* h = r->h;
+  uint64_t tail, claim;
+  /* only claimed records: beyond them, done flags may be stale */
+  claim = __atomic_load_n(&r->claim, __ATOMIC_ACQUIRE);
+  for (tail = h->tail; tail != claim && __atomic_load_n(&record_at(r, tail)->done, __ATOMIC_ACQUIRE);)
+    tail += record_size(record_at(r, tail));
+  __atomic_store_n(&h->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* post completions for the records at pos[] (with the document lengths
+ * len[], or their own), then reclaim */
+static void complete_batch(Ring* r, uint64_t const* pos, int32_t const* lang, uint32_t const* len, unsigned n) {
+  RingHeader* h = r->h;
+  uint64_t head;
+  unsigned i;
+
+  pthread_mutex_lock(&r->comp_lock);
+  head = h->comp_head;
+  for (i = 0; i < n; i++) {
+    RingRecord* rec = record_at(r, pos[i]);
+    if (lang[i] != NO_COMPLETION) {
+      /* the producer keeps no more documents in flight than comp_size */
+      RingCompletion* c = &r->comp[head++ & (h->comp_size - 1)];
+      c->tag = rec->tag;
+      c->lang = lang[i];
+      c->len = len ? len[i] : rec->len;
+    }
+    __atomic_store_n(&rec->done, 1, __ATOMIC_RELEASE);
+  }
+  reclaim(r);
+  __atomic_store_n(&h->comp_head, head, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&h->comp_seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->producer_waiting, __ATOMIC_SEQ_CST)) futex_wake_u32(&h->comp_seq, 1);
+  pthread_mutex_unlock(&r->comp_lock);
+}
+
+static void push_interactive(Ring* r, uint64_t pos, uint64_t t) {
+  if (r->itail - r->ihead == r->icap) {
+    size_t cap = r->icap ? 2 * r->icap : 1024, i;
+    uint64_t *p, *q;
+    if ((p = (uint64_t*)malloc(cap * sizeof(uint64_t))) == 0 || (q = (uint64_t*)malloc(cap * sizeof(uint64_t))) == 0)
+      exit(-1);
+    for (i = r->ihead; i != r->itail; i++) {
+      p[i & (cap - 1)] = r->ipos[i & (r->icap - 1)];
+      q[i & (cap - 1)] = r->itime[i & (r->icap - 1)];
+    }
+    free(r->ipos);
+    free(r->itime);
+    r->ipos = p;
+    r->itime = q;
+    r->icap = cap;
+  }
+  r->ipos[r->itail & (r->icap - 1)] = pos;
+  r->itime[r->itail++ & (r->icap - 1)] = t;
+}
+
+static unsigned pop_interactive(Ring* r, uint64_t* pos, uint64_t* t) {
+  unsigned n = 0;
+  for (; r->ihead != r->itail && n < RING_BATCH; r->ihead++, n++) {
+    pos[n] = r->ipos[r->ihead & (r->icap - 1)];
+    t[n] = r->itime[r->ihead & (r->icap - 1)];
+  }
+  return n;
+}
+
+/* the job still taking records under tag, if any */
+static Job* find_job(Ring* r, uint64_t tag) {
+  Job* j;
+  for (j = r->jobs; j; j = j->next)
+    if (j->tag == tag && !j->last_claimed) return j;
+  return NULL;
+}
+
+static void add_chunk(Ring* r, Job* j, RingRecord const* rec, uint64_t pos, uint64_t t) {
+  if (!j) {
+    if ((j = (Job*)calloc(1, sizeof(Job))) == 0) exit(-1);
+    j->tag = rec->tag;
+    j->lid = r->nspare ? r->spare[--r->nspare] : clone_identifier(r->model);
+    identify_begin(j->lid);
+    j->start = t;
+    j->next = r->jobs;
+    r->jobs = j;
+  }
+  if (j->n == j->cap && (j->chunks = (uint64_t*)realloc(j->chunks, (j->cap = j->cap ? 2 * j->cap : 4) *
+                                                                       sizeof(uint64_t))) == 0)
+    exit(-1);
+  j->chunks[j->n++] = pos;
+  j->last_claimed = !(rec->flags & RING_MORE);
+  if (!j->running && !j->queued) {
+    j->queued = 1;
+    j->next_run = NULL;
+    if (r->run_tail)
+      r->run_tail->next_run = j;
+    else
+      r->run_head = j;
+    r->run_tail = j;
+  }
+}
+
+static int record_class(RingRecord const* rec) {
+  if (rec->flags & RING_MORE) return CLASS_BULK;
+  if (rec->flags & RING_INTERACTIVE) return CLASS_INTERACTIVE;
+  return rec->flags & RING_BULK || rec->len > RING_INTERACTIVE_MAX ? CLASS_BULK : CLASS_INTERACTIVE;
+}
+
+/* sort up to RING_BATCH records before head into the lanes; lock held */
+static void claim_records(Ring* r, uint64_t head) {
+  uint64_t t = now_ns();
+  unsigned n = 0, skipped = 0;
+  Job* j;
+  for (; r->claim != head && n < RING_BATCH; n++) {
+    uint64_t pos = r->claim;
+    RingRecord* rec = record_at(r, pos);
+    /* reclaim reads claim without lock */
+    __atomic_store_n(&r->claim, pos + record_size(rec), __ATOMIC_RELEASE);
+    if (rec->len == RING_SKIP) {
+      __atomic_store_n(&rec->done, 1, __ATOMIC_RELEASE);
+      skipped = 1;
+    } else if ((j = find_job(r, rec->tag)) || record_class(rec) == CLASS_BULK)
+      add_chunk(r, j, rec, pos, t);
+    else
+      push_interactive(r, pos, t);
+  }
+  if (skipped) {
+    pthread_mutex_lock(&r->comp_lock);
+    reclaim(r);
+    pthread_mutex_unlock(&r->comp_lock);
+  }
+  LANGID_PROBE(ring__claim, n, r->itail - r->ihead);
+  pthread_cond_broadcast(&r->cond);
+  if (r->polling) {
+    __atomic_add_fetch(&r->h->sub_seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake_u32(&r->h->sub_seq, 1 << 30);
+  }
+}
+
+/* the next interactive batch for w (its size), or else a bulk job in *job
+ * (returning 0); -1 once the ring is closed and drained */
+static int next_work(Ring* r, Worker* w, uint64_t* pos, uint64_t* t, Job** job) {
+  RingHeader* h = r->h;
+  uint64_t head;
+  uint32_t seq;
+  int n;
+
+  pthread_mutex_lock(&r->lock);
+  for (;;) {
+    if ((n = pop_interactive(r, pos, t))) break;
+    if (!w->reserved && (*job = r->run_head)) {
+      if (!(r->run_head = (*job)->next_run)) r->run_tail = NULL;
+      (*job)->queued = 0;
+      (*job)->running = 1;
+      break;
+    }
+    seq = __atomic_load_n(&h->sub_seq, __ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    if (r->claim != head) {
+      claim_records(r, head);
+      continue;
+    }
+    if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) {
+      /* running jobs have all their chunks: their workers finish them */
+      pthread_cond_broadcast(&r->cond);
+      n = -1;
+      break;
+    }
+    if (r->polling) {
+      pthread_cond_wait(&r->cond, &r->lock);
+      continue;
+    }
+    r->polling = 1;
+    __atomic_add_fetch(&h->workers_waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&r->lock);
+    futex_wait_u32(&h->sub_seq, seq);
+    __atomic_sub_fetch(&h->workers_waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&r->lock);
+    r->polling = 0;
+    pthread_cond_broadcast(&r->cond);
+  }
+  pthread_mutex_unlock(&r->lock);
+  return n;
+}
+
+static void run_interactive(Ring* r, Worker* w, uint64_t const* pos, uint64_t const* t, unsigned n) {
+  int32_t lang[RING_BATCH] = {0}; /* n is never 0, but gcc can't tell */
+  uint64_t done, tag[RING_BATCH];
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    RingRecord* rec = record_at(r, pos[i]);
+    lang[i] = identify_index(w->lid, (char const*)(rec + 1), rec->len);
+    tag[i] = rec->tag; /* the record may be reused once completed */
+  }
+  complete_batch(r, pos, lang, NULL, n);
+  done = now_ns();
+  for (i = 0; i < n; i++) {
+    add_latency(&w->latency[CLASS_INTERACTIVE], done - t[i]);
+    LANGID_PROBE(ring__done, tag[i], CLASS_INTERACTIVE, done - t[i]);
+  }
+}
+
+/* between bulk slices: sort new records, and run an interactive batch */
+static void yield_to_interactive(Ring* r, Worker* w) {
+  uint64_t pos[RING_BATCH], t[RING_BATCH], head;
+  unsigned n;
+  pthread_mutex_lock(&r->lock);
+  head = __atomic_load_n(&r->h->head, __ATOMIC_ACQUIRE);
+  if (r->claim != head) claim_records(r, head);
+  n = pop_interactive(r, pos, t);
+  pthread_mutex_unlock(&r->lock);
+  if (n) run_interactive(r, w, pos, t, n);
+}
+
+/* feed the job's claimed chunks, completing the document at its last */
+static void run_job(Ring* r, Worker* w, Job* j) {
+  double logprobs[r->model->num_langs];
+  uint64_t pos;
+  uint32_t off, n, len;
+  int32_t lang;
+  RingRecord* rec;
+  char const* text;
+  Job** p;
+
+  for (;;) {
+    pthread_mutex_lock(&r->lock);
+    pos = j->chunks[j->first];
+    pthread_mutex_unlock(&r->lock);
+    rec = record_at(r, pos);
+    text = (char const*)(rec + 1);
+    for (off = 0; off < rec->len; off += n) {
+      n = rec->len - off < RING_SLICE ? rec->len - off : RING_SLICE;
+      identify_feed(j->lid, text + off, n);
+      if (off + n < rec->len) yield_to_interactive(r, w);
+    }
+    j->len += rec->len;
+    if (rec->flags & RING_MORE)
+      lang = NO_COMPLETION;
+    else {
+      identify_end_logprobs(j->lid, logprobs);
+      lang = logprob_to_pred(j->lid, logprobs);
+    }
+    len = j->len;
+    complete_batch(r, &pos, &lang, &len, 1);
+
+    pthread_mutex_lock(&r->lock);
+    if (lang != NO_COMPLETION) {
+      for (p = &r->jobs; *p != j; p = &(*p)->next)
+        ;
+      *p = j->next;
+      if (r->nspare < r->max_spare)
+        r->spare[r->nspare++] = j->lid;
+      else
+        destroy_identifier(j->lid);
+      pthread_mutex_unlock(&r->lock);
+      add_latency(&w->latency[CLASS_BULK], now_ns() - j->start);
+      LANGID_PROBE(ring__done, j->tag, CLASS_BULK, now_ns() - j->start);
+      free(j->chunks);
+      free(j);
+      return;
+    }
+    if (++j->first == j->n) {
+      /* claim_records queues it again with its next chunk */
+      j->first = j->n = 0;
+      j->running = 0;
+      pthread_mutex_unlock(&r->lock);
+      return;
+    }
+    pthread_mutex_unlock(&r->lock);
+    yield_to_interactive(r, w);
+  }
+}
+
+static void* work(void* arg) {
+  Worker* w = (Worker*)arg;
+  Ring* r = w->ring;
+  uint64_t pos[RING_BATCH], t[RING_BATCH];
+  Job* job;
+  int n;
+
+  while ((n = next_work(r, w, pos, t, &job)) != -1)
+    if (n)
+      run_interactive(r, w, pos, t, n);
+    else
+      run_job(r, w, job);
+  return NULL;
+}
+
+static void report_latency(FILE* f, Worker const* w, unsigned workers, unsigned reserved) {
+  Latency l;
+  unsigned c, i, k;
+  for (c = 0; c < NUM_CLASSES; c++) {
+    memset(&l, 0, sizeof(l));
+    for (i = 0; i < workers; i++) {
+      l.n += w[i].latency[c].n;
+      if (w[i].latency[c].max > l.max) l.max = w[i].latency[c].max;
+      for (k = 0; k < LATENCY_BUCKETS; k++) l.count[k] += w[i].latency[c].count[k];
+    }
+    fprintf(f, "%s: %llu documents", class_names[c], (unsigned long long)l.n);
+    if (l.n)
+      fprintf(f, ", latency p50 %.1f us, p99 %.1f us, max %.1f us", percentile_us(&l, 0.5), percentile_us(&l, 0.99),
+              l.max / 1e3);
+    fputc('\n', f);
+  }
+  fprintf(f, "%u workers, %u of them interactive only\n", workers, reserved);
+}
+
+int serve_ring(char const* name, LanguageIdentifier* lid, unsigned workers, FILE* stats) {
+  Ring r;
+  RingHeader* h;
+  Worker* w;
+  size_t map_size = ring_map_size(RING_DATA_SIZE, RING_COMP_SIZE), used = 0, len;
+  unsigned i, reserved;
+  int fd;
+
+  shm_unlink(name);
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1 || ftruncate(fd, map_size)) {
+    fprintf(stderr, "unable to create shared memory ring: %s\n", name);
+    return -1;
+  }
+  h = (RingHeader*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (h == MAP_FAILED) {
+    fprintf(stderr, "unable to map shared memory ring: %s\n", name);
+    return -1;
+  }
+  h->data_size = RING_DATA_SIZE;
+  h->comp_size = RING_COMP_SIZE;
+  h->num_langs = lid->num_langs;
+  for (i = 0; i < lid->num_langs; i++) {
+    len = strlen(get_lang_name(lid, i)) + 1;
+    if (used + len > RING_LANGS_SIZE) break;
+    memcpy(h->langs + used, get_lang_name(lid, i), len);
+    used += len;
+  }
+  memcpy(h->magic, RING_MAGIC, 8);
+
+  if (!workers) workers = 1;
+  reserved = workers >= 2 ? (workers + 3) / 4 : 0;
+  memset(&r, 0, sizeof(r));
+  r.h = h;
+  r.data = (char*)(h + 1);
+  r.comp = (RingCompletion*)(r.data + h->data_size);
+  r.model = lid;
+  r.max_spare = workers;
+  if ((r.spare = (LanguageIdentifier**)malloc(workers * sizeof(LanguageIdentifier*))) == 0) exit(-1);
+  pthread_mutex_init(&r.lock, NULL);
+  pthread_mutex_init(&r.comp_lock, NULL);
+  pthread_cond_init(&r.cond, NULL);
+
+  if ((w = (Worker*)calloc(workers, sizeof(Worker))) == 0) exit(-1);
+  for (i = 0; i < workers; i++) {
+    w[i].ring = &r;
+    w[i].lid = i ? clone_identifier(lid) : lid;
+    w[i].reserved = i < reserved;
+  }
+  __atomic_store_n(&h->ready, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < workers; i++) pthread_create(&w[i].thread, NULL, work, &w[i]);
+  for (i = 0; i < workers; i++) pthread_join(w[i].thread, NULL);
+  if (stats) report_latency(stats, w, workers, reserved);
+  for (i = 1; i < workers; i++) destroy_identifier(w[i].lid);
+  for (i = 0; i < r.nspare; i++) destroy_identifier(r.spare[i]);
+  free(r.spare);
+  free(r.ipos);
+  free(r.itime);
+  free(w);
+
+  shm_unlink(name);
+  munmap(h, map_size);
+  return 0;
+}
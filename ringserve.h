@@ -0,0 +1,13 @@
+#ifndef _RINGSERVE_H
+#define _RINGSERVE_H
+
+#include "liblangid.h"
+#include <stdio.h>
+
+/** serve the shared-memory ring /dev/shm/name (see ring.h) with the given
+    number of worker threads, until its producer closes it; then write
+    each document class's latency percentiles (from when a worker takes the
+    document off the ring to its completion) to stats, if not NULL */
+extern int serve_ring(char const* name, LanguageIdentifier*, unsigned workers, FILE* stats);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Sampled language histograms with confidence intervals; see sample.h
+ */
+
+#include "sample.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+LangHist* open_hist(unsigned num_langs) {
+  LangHist* h;
+  double* w;
+  if ((h = (LangHist*)calloc(1, sizeof(LangHist))) == 0) exit(-1);
+  if ((w = (double*)calloc(4 * (num_langs + 1), sizeof(double))) == 0) exit(-1);
+  h->num_langs = num_langs;
+  h->doc_w = w;
+  h->doc_w2 = w + (num_langs + 1);
+  h->byte_w = w + 2 * (num_langs + 1);
+  h->byte_w2 = w + 3 * (num_langs + 1);
+  return h;
+}
+
+void close_hist(LangHist* h) {
+  free(h->doc_w);
+  free(h);
+}
+
+void hist_add(LangHist* h, LangIndex i, double doc_w, double byte_w) {
+  unsigned all = h->num_langs;
+  h->doc_w[i] += doc_w;
+  h->doc_w2[i] += doc_w * doc_w;
+  h->byte_w[i] += byte_w;
+  h->byte_w2[i] += byte_w * byte_w;
+  h->doc_w[all] += doc_w;
+  h->doc_w2[all] += doc_w * doc_w;
+  h->byte_w[all] += byte_w;
+  h->byte_w2[all] += byte_w * byte_w;
+  ++h->n;
+}
+
+/* sum w^2 (I - p)^2 = s2 (1 - 2p) + p^2 s2_all */
+static double share(double const* w, double const* w2, unsigned i, unsigned all, double* half) {
+  double p = w[all] > 0 ? w[i] / w[all] : 0, var;
+  if (!(w[all] > 0)) {
+    *half = 1;
+    return 0;
+  }
+  var = (w2[i] * (1 - 2 * p) + p * p * w2[all]) / (w[all] * w[all]);
+  *half = HIST_Z * sqrt(var > 0 ? var : 0);
+  return p;
+}
+
+double hist_halfwidth(LangHist const* h) {
+  /* a language not seen yet may still have a share up to 3/n */
+  double worst = h->n ? 3.0 / h->n : 1, half;
+  unsigned i;
+  for (i = 0; i < h->num_langs; ++i) {
+    share(h->doc_w, h->doc_w2, i, h->num_langs, &half);
+    if (half > worst) worst = half;
+  }
+  return worst;
+}
+
+size_t hist_sample_size(double eps) {
+  double n = ceil(HIST_Z * HIST_Z * 0.25 / (eps * eps));
+  return n < HIST_MAX_SAMPLE ? (size_t)n : HIST_MAX_SAMPLE;
+}
+
+static LangHist const* sort_hist;
+static int by_doc_share(void const* a, void const* b) {
+  double x = sort_hist->doc_w[*(unsigned const*)a], y = sort_hist->doc_w[*(unsigned const*)b];
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static double clamp01(double x) { return x < 0 ? 0 : x > 1 ? 1 : x; }
+
+void write_hist(LangHist const* h, LanguageIdentifier* lid, FILE* f, char const* unit) {
+  unsigned i, j, all = h->num_langs, order[all];
+  double p, half, q, qhalf;
+  for (i = 0; i < all; ++i) order[i] = i;
+  sort_hist = h;
+  qsort(order, all, sizeof(unsigned), by_doc_share);
+  fprintf(f, "lang\t%s\tlo\thi\tbytes\tlo\thi\n", unit);
+  for (j = 0; j < all; ++j) {
+    i = order[j];
+    if (!(h->doc_w[i] > 0)) break;
+    p = share(h->doc_w, h->doc_w2, i, all, &half);
+    q = share(h->byte_w, h->byte_w2, i, all, &qhalf);
+    fprintf(f, "%s\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n", get_lang_name(lid, i), p, clamp01(p - half),
+            clamp01(p + half), q, clamp01(q - qhalf), clamp01(q + qhalf));
+  }
+}
+
+uint64_t sample_rand(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+uint64_t sample_below(uint64_t* state, uint64_t n) {
+  return (uint64_t)(((unsigned __int128)sample_rand(state) * n) >> 64);
+}
+
+Reservoir* open_reservoir(size_t k, uint64_t seed) {
+  Reservoir* r;
+  if ((r = (Reservoir*)calloc(1, sizeof(Reservoir))) == 0) exit(-1);
+  r->k = k;
+  r->rng = seed ? seed : 1;
+  if ((r->recs = (char**)calloc(k, sizeof(char*))) == 0) exit(-1);
+  if ((r->lens = (size_t*)malloc(k * sizeof(size_t))) == 0) exit(-1);
+  if ((r->sizes = (double*)malloc(k * sizeof(double))) == 0) exit(-1);
+  return r;
+}
+
+void close_reservoir(Reservoir* r) {
+  size_t i;
+  for (i = 0; i < r->k; ++i) free(r->recs[i]);
+  free(r->recs);
+  free(r->lens);
+  free(r->sizes);
+  free(r);
+}
+
+void reservoir_add(Reservoir* r, char const* rec, size_t len, double size) {
+  size_t slot = r->n < r->k ? r->n : sample_below(&r->rng, r->n + 1);
+  ++r->n;
+  if (slot >= r->k) return;
+  if ((r->recs[slot] = (char*)realloc(r->recs[slot], len + 1)) == 0) exit(-1);
+  memcpy(r->recs[slot], rec, len);
+  r->recs[slot][len] = 0;
+  r->lens[slot] = len;
+  r->sizes[slot] = size;
+}
+
+void shuffle_reservoir(Reservoir* r) {
+  size_t i, j, kept = r->n < r->k ? r->n : r->k, len;
+  char* rec;
+  double size;
+  for (i = kept; i > 1; --i) {
+    j = sample_below(&r->rng, i);
+    rec = r->recs[i - 1], r->recs[i - 1] = r->recs[j], r->recs[j] = rec;
+    len = r->lens[i - 1], r->lens[i - 1] = r->lens[j], r->lens[j] = len;
+    size = r->sizes[i - 1], r->sizes[i - 1] = r->sizes[j], r->sizes[j] = size;
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+#include "liblangid.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The language mix of a corpus from a random sample (-H), with 95%
+ * confidence intervals. Each sampled document i of language l contributes
+ * weights w_i to the estimates of both the share of documents and the share
+ * of bytes in l, p = sum_l w_i / sum w_i, whose variance is estimated as
+ * sum w_i^2 (I_i - p)^2 / (sum w_i)^2. Documents drawn uniformly (reservoir
+ * sampling of a stream) have document weight 1 and byte weight their size;
+ * lines found by uniform random seeks into a file are drawn in proportion
+ * to their size, so their document weight is 1/size and byte weight 1.
+ * Sampling stops once every document share's interval is within +-eps,
+ * and 3/n <= eps (the 95% bound on the share of languages not sampled).
+ */
+
+#define HIST_Z 1.96
+/* the sample grows in steps of this many documents */
+#define HIST_STEP 256
+#define HIST_MAX_SAMPLE (1u << 22)
+/* samples are reproducible */
+#define HIST_SEED 0x9e3779b97f4a7c15ull
+
+typedef struct {
+  unsigned num_langs;
+  size_t n; /* documents classified */
+  /* per language, then the total in [num_langs]: sums of w and w^2 */
+  double *doc_w, *doc_w2, *byte_w, *byte_w2;
+} LangHist;
+
+extern LangHist* open_hist(unsigned num_langs);
+extern void close_hist(LangHist*);
+extern void hist_add(LangHist*, LangIndex, double doc_w, double byte_w);
+/** the largest document share's confidence interval half-width */
+extern double hist_halfwidth(LangHist const*);
+/** the reservoir size whose uniform document shares are within +-eps
+    whatever they are */
+extern size_t hist_sample_size(double eps);
+/** tab-separated language, document share and its interval, byte share and
+    its interval, by decreasing document share; unit names the documents */
+extern void write_hist(LangHist const*, LanguageIdentifier*, FILE*, char const* unit);
+
+/** xorshift64* */
+extern uint64_t sample_rand(uint64_t* state);
+/** uniform in [0, n) */
+extern uint64_t sample_below(uint64_t* state, uint64_t n);
+
+/* Algorithm R over a stream of records, keeping copies of k of them */
+typedef struct {
+  size_t k, n; /* kept, seen */
+  char** recs;
+  size_t* lens;
+  double* sizes; /* the byte weight of each kept record */
+  uint64_t rng;
+} Reservoir;
+
+extern Reservoir* open_reservoir(size_t k, uint64_t seed);
+extern void close_reservoir(Reservoir*);
+extern void reservoir_add(Reservoir*, char const* rec, size_t len, double size);
+/** put the kept records in random order, so any prefix is a uniform sample */
+extern void shuffle_reservoir(Reservoir*);
+
+#endif
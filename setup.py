@@ -3,7 +3,7 @@ from distutils.core import setup, Extension
 langid = Extension("_langid", 
                    language = 'c',
                    libraries = ['protobuf-c'],
-                   sources = ["_langid.c", "liblangid.c", "model.c", "sparseset.c", "langid.pb-c.c"],
+                   sources = ["_langid.c", "liblangid.c", "config.c", "hashfv.c", "model.c", "sparseset.c", "langid.pb-c.c"],
                    )
 
 setup(
@@ -0,0 +1,117 @@
+/*
+ * Partitioning of batch-mode path lists across hosts; see shard.h
+ */
+
+#include "shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+int parse_shard(char const* spec, Shard* s) {
+  char* end;
+  s->i = strtoul(spec, &end, 10);
+  if (end == spec || *end != '/') return 0;
+  s->n = strtoul(end + 1, &end, 10);
+  return !*end && s->i < s->n;
+}
+
+uint64_t path_hash(char const* path) {
+  uint64_t h = 14695981039346656037ull;
+  for (; *path; ++path) h = (h ^ (unsigned char)*path) * 1099511628211ull;
+  return h;
+}
+
+int shard_owns(Shard const* s, char const* path) { return path_hash(path) % s->n == s->i; }
+
+PathList* read_paths(RecordReader* in) {
+  PathList* p;
+  char const* rec;
+  size_t len, cap = 0, cap_n = 0, used = 0;
+  off_t off = 0;
+
+  if ((p = (PathList*)calloc(1, sizeof(PathList))) == 0) exit(-1);
+  while (next_record(in, &rec, &len)) {
+    off += in->consumed;
+    if (used + len + 1 > cap) {
+      cap = 2 * (used + len + 1);
+      if ((p->buf = (char*)realloc(p->buf, cap)) == 0) exit(-1);
+    }
+    if (p->n == cap_n) {
+      cap_n = cap_n ? 2 * cap_n : 1024;
+      if ((p->start = (size_t*)realloc(p->start, cap_n * sizeof(size_t))) == 0) exit(-1);
+      if ((p->end = (off_t*)realloc(p->end, cap_n * sizeof(off_t))) == 0) exit(-1);
+    }
+    memcpy(p->buf + used, rec, len);
+    p->buf[used + len] = '\0';
+    p->start[p->n] = used;
+    p->end[p->n++] = off;
+    used += len + 1;
+  }
+  if ((p->mine = (char*)calloc(p->n + 1, 1)) == 0) exit(-1);
+  return p;
+}
+
+static off_t* sort_sizes;
+
+/* larger first, then earlier in the list first, so the order is total */
+static int cmp_size_desc(void const* a, void const* b) {
+  size_t x = *(size_t const*)a, y = *(size_t const*)b;
+  if (sort_sizes[x] != sort_sizes[y]) return sort_sizes[x] < sort_sizes[y] ? 1 : -1;
+  return x < y ? -1 : x > y;
+}
+
+/* min-heap of shards by (load, index) */
+typedef struct {
+  off_t load;
+  unsigned shard;
+} Bin;
+
+static int bin_less(Bin const* a, Bin const* b) {
+  return a->load < b->load || (a->load == b->load && a->shard < b->shard);
+}
+
+static void sift_down(Bin* heap, unsigned n, unsigned i) {
+  unsigned c;
+  Bin t;
+  for (; (c = 2 * i + 1) < n; i = c) {
+    if (c + 1 < n && bin_less(&heap[c + 1], &heap[c])) ++c;
+    if (!bin_less(&heap[c], &heap[i])) break;
+    t = heap[c], heap[c] = heap[i], heap[i] = t;
+  }
+}
+
+void assign_balanced(PathList* p, Shard const* s) {
+  size_t i, *order;
+  unsigned j;
+  Bin* heap;
+  struct stat st;
+
+  if ((sort_sizes = (off_t*)malloc((p->n + 1) * sizeof(off_t))) == 0) exit(-1);
+  if ((order = (size_t*)malloc((p->n + 1) * sizeof(size_t))) == 0) exit(-1);
+  if ((heap = (Bin*)malloc(s->n * sizeof(Bin))) == 0) exit(-1);
+  for (i = 0; i < p->n; i++) {
+    /* missing files still cost an open; count them as one byte */
+    sort_sizes[i] = stat(p->buf + p->start[i], &st) ? 1 : st.st_size + 1;
+    order[i] = i;
+  }
+  qsort(order, p->n, sizeof(size_t), cmp_size_desc);
+  /* all loads are 0, so shards in index order already form a heap */
+  for (j = 0; j < s->n; j++) heap[j].load = 0, heap[j].shard = j;
+  for (i = 0; i < p->n; i++) {
+    p->mine[order[i]] = heap[0].shard == s->i;
+    heap[0].load += sort_sizes[order[i]];
+    sift_down(heap, s->n, 0);
+  }
+  free(heap);
+  free(order);
+  free(sort_sizes);
+}
+
+void free_paths(PathList* p) {
+  free(p->buf);
+  free(p->start);
+  free(p->end);
+  free(p->mine);
+  free(p);
+}
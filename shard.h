@@ -0,0 +1,38 @@
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include "records.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Deterministic partitioning of a batch-mode path list into n shards, so
+ * that n hosts given the same list and -s i/n each process a disjoint part
+ * of it. Either by a hash of the path, or (balanced) by total file size:
+ * every host stats every path and assigns them largest-first to the
+ * currently smallest shard, which gives every host the same assignment.
+ */
+typedef struct {
+  unsigned i, n;
+  int balanced;
+} Shard;
+
+/** parse "i/n" (0 <= i < n); 0 if malformed */
+extern int parse_shard(char const*, Shard*);
+/** FNV-1a; the shard of a path is path_hash % n */
+extern uint64_t path_hash(char const*);
+extern int shard_owns(Shard const*, char const* path);
+
+/* the whole path list, for the balanced stat pre-pass */
+typedef struct {
+  char* buf;     /* NUL-terminated paths, back to back */
+  size_t n;      /* number of paths */
+  size_t* start; /* path i is buf + start[i] */
+  off_t* end;    /* input offset just past path i's line */
+  char* mine;    /* path i belongs to this shard */
+} PathList;
+
+extern PathList* read_paths(RecordReader*);
+extern void assign_balanced(PathList*, Shard const*);
+extern void free_paths(PathList*);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Per-call latency of the short-text path against the general one:
+ *
+ *   shortbench [-m model] [-s sizes] [-n calls] < corpus
+ *
+ * cuts stdin into documents of each size, checks that both paths give the
+ * same language (and nearly the same scores) for every one, and reports
+ * nanoseconds per call.
+ */
+
+#include "liblangid.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+char const *getoptspec = "hm:s:n:";
+
+void usage() {
+  printf("shortbench [-m model] [-s sizes] [-n calls] < corpus (%s)\n"
+         "\n -m: load model file"
+         "\n -s: comma-separated document sizes in bytes, up to %d (default "
+         "8,16,32,64,128,256)"
+         "\n -n: calls timed per size and path (default 200000)"
+         "\n\n",
+         getoptspec, SHORT_TEXT_MAX);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void general_logprobs(LanguageIdentifier *lid, char const *text,
+                             unsigned len, double *logprobs) {
+  text_to_fv(lid, text, len, lid->sv, lid->fv);
+  fv_to_logprob(lid, lid->fv, logprobs);
+}
+
+typedef void Path(LanguageIdentifier *, char const *, unsigned, double *);
+
+/* ns per call over calls documents of size bytes, cycling through text */
+static double latency(LanguageIdentifier *lid, Path *path, char const *text,
+                      size_t len, size_t size, unsigned long calls,
+                      unsigned long *sum) {
+  double logprobs[lid->num_langs], t = now();
+  size_t off = 0;
+  unsigned long i;
+  for (i = 0; i < calls; i++) {
+    path(lid, text + off, size, logprobs);
+    *sum += logprob_to_pred(lid, logprobs);
+    if ((off += size) + size > len)
+      off = 0;
+  }
+  return (now() - t) * 1e9 / calls;
+}
+
+int main(int argc, char **argv) {
+  char *model_path = NULL, *sizes = "8,16,32,64,128,256", *text = NULL, *end;
+  size_t text_size = 0, len, size, off, differ;
+  unsigned long calls = 200000, sum = 0;
+  LanguageIdentifier *lid;
+  double general, fast, diff, worst;
+  unsigned i;
+  int c;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'm':
+      model_path = optarg;
+      break;
+    case 's':
+      sizes = optarg;
+      break;
+    case 'n':
+      calls = strtoul(optarg, NULL, 10);
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+
+  len = getdelim(&text, &text_size, EOF, stdin);
+  if ((ssize_t)len <= 0) {
+    fprintf(stderr, "shortbench: no input\n");
+    return 1;
+  }
+  lid = model_path ? load_identifier(model_path) : get_default_identifier();
+  double a[lid->num_langs], b[lid->num_langs];
+
+  printf("%8s %12s %12s %8s %14s\n", "size", "general ns", "short ns",
+         "speedup", "max |diff|");
+  for (; *sizes; sizes = *end ? end + 1 : end) {
+    if (!(size = strtoul(sizes, &end, 10)) || size > len ||
+        size > SHORT_TEXT_MAX)
+      continue;
+    for (differ = off = 0, worst = 0; off + size <= len; off += size) {
+      general_logprobs(lid, text + off, size, a);
+      short_text_logprobs(lid, text + off, size, b);
+      differ += logprob_to_pred(lid, a) != logprob_to_pred(lid, b);
+      for (i = 0; i < lid->num_langs; i++)
+        if ((diff = fabs(a[i] - b[i])) > worst)
+          worst = diff;
+    }
+    if (differ) {
+      fprintf(stderr, "shortbench: %zu documents of %zu bytes differ\n",
+              differ, size);
+      return 1;
+    }
+    general = latency(lid, general_logprobs, text, len, size, calls, &sum);
+    fast = latency(lid, short_text_logprobs, text, len, size, calls, &sum);
+    printf("%8zu %12.0f %12.0f %8.2f %14.3g\n", size, general, fast,
+           general / fast, worst);
+  }
+
+  fprintf(stderr, "(checksum %lu)\n", sum);
+  destroy_identifier(lid);
+  free(text);
+  return 0;
+}
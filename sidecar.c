@@ -0,0 +1,141 @@
+/*
+ * Language index sidecar: written by langid -x while tagging a line file,
+ * read by langidx to select lines by language without reclassifying.
+ */
+
+#include "sidecar.h"
+#include "liblangid.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void put_u32(FILE* f, uint32_t x) {
+  unsigned char b[4] = {x, x >> 8, x >> 16, x >> 24};
+  fwrite(b, 1, 4, f);
+}
+
+static void put_u64(FILE* f, uint64_t x) {
+  put_u32(f, (uint32_t)x);
+  put_u32(f, (uint32_t)(x >> 32));
+}
+
+static uint32_t get_u32(unsigned char const* p) {
+  return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(unsigned char const* p) { return get_u32(p) | (uint64_t)get_u32(p + 4) << 32; }
+
+SidecarWriter* open_sidecar(char const* path, LanguageIdentifier* lid) {
+  SidecarWriter* w;
+  unsigned i;
+
+  if (lid->num_langs >= SIDECAR_NONE) {
+    fprintf(stderr, "too many languages (%u) for a sidecar index\n", lid->num_langs);
+    exit(-1);
+  }
+  if ((w = (SidecarWriter*)malloc(sizeof(SidecarWriter))) == 0) exit(-1);
+  if ((w->counts = (uint64_t*)calloc(lid->num_langs + 1, sizeof(uint64_t))) == 0) exit(-1);
+  if (!(w->f = fopen(path, "wb"))) {
+    fprintf(stderr, "unable to open: %s\n", path);
+    exit(-1);
+  }
+  w->num_langs = lid->num_langs;
+  w->num_lines = 0;
+
+  fwrite("LIDX", 1, 4, w->f);
+  put_u32(w->f, SIDECAR_VERSION);
+  put_u32(w->f, w->num_langs);
+  put_u64(w->f, 0); /* num_lines and trailer_offset are patched by close */
+  put_u64(w->f, 0);
+  for (i = 0; i < w->num_langs; i++) fwrite((*lid->nb_classes)[i], 1, strlen((*lid->nb_classes)[i]) + 1, w->f);
+  return w;
+}
+
+void sidecar_add(SidecarWriter* w, LangIndex i, size_t linelen) {
+  unsigned char b[11], *p = b;
+  if (i >= w->num_langs) i = SIDECAR_NONE;
+  *p++ = i;
+  do {
+    *p = linelen & 0x7f;
+    linelen >>= 7;
+    if (linelen) *p |= 0x80;
+  } while (*p++ & 0x80);
+  fwrite(b, 1, p - b, w->f);
+  ++w->counts[i == SIDECAR_NONE ? w->num_langs : i];
+  ++w->num_lines;
+}
+
+void close_sidecar(SidecarWriter* w) {
+  unsigned i;
+  long trailer = ftell(w->f);
+  for (i = 0; i <= w->num_langs; i++) put_u64(w->f, w->counts[i]);
+  fseek(w->f, 12, SEEK_SET);
+  put_u64(w->f, w->num_lines);
+  put_u64(w->f, trailer);
+  if (fclose(w->f)) {
+    fprintf(stderr, "error writing sidecar index\n");
+    exit(-1);
+  }
+  free(w->counts);
+  free(w);
+}
+
+SidecarReader* load_sidecar(char const* path) {
+  SidecarReader* r;
+  unsigned char const* p;
+  uint64_t trailer;
+  unsigned i;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    fprintf(stderr, "unable to open: %s\n", path);
+    exit(-1);
+  }
+  if ((r = (SidecarReader*)malloc(sizeof(SidecarReader))) == 0) exit(-1);
+  r->len = lseek(fd, 0, SEEK_END);
+  if (r->len < 28
+      || (r->base = (unsigned char const*)mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED
+      || memcmp(r->base, "LIDX", 4) || get_u32(r->base + 4) != SIDECAR_VERSION) {
+    fprintf(stderr, "not a sidecar index: %s\n", path);
+    exit(-1);
+  }
+  close(fd);
+  madvise((void*)r->base, r->len, MADV_SEQUENTIAL);
+
+  r->num_langs = get_u32(r->base + 8);
+  r->num_lines = get_u64(r->base + 12);
+  trailer = get_u64(r->base + 20);
+  if (!trailer || trailer + 8 * (r->num_langs + 1) != r->len) {
+    fprintf(stderr, "truncated sidecar index: %s\n", path);
+    exit(-1);
+  }
+  if ((r->names = (char const**)malloc(r->num_langs * sizeof(char*))) == 0) exit(-1);
+  for (p = r->base + 28, i = 0; i < r->num_langs; i++) {
+    r->names[i] = (char const*)p;
+    p += strlen((char const*)p) + 1;
+  }
+  r->recs = p;
+  r->end = r->base + trailer;
+  return r;
+}
+
+void destroy_sidecar(SidecarReader* r) {
+  munmap((void*)r->base, r->len);
+  free(r->names);
+  free(r);
+}
+
+uint64_t sidecar_count(SidecarReader* r, unsigned i) {
+  if (i >= r->num_langs) i = r->num_langs;
+  return get_u64(r->end + 8 * i);
+}
+
+unsigned sidecar_lang_index(SidecarReader* r, char const* name) {
+  unsigned i;
+  for (i = 0; i < r->num_langs; i++)
+    if (!strcmp(r->names[i], name)) return i;
+  return SIDECAR_NONE;
+}
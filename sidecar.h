@@ -0,0 +1,62 @@
+#ifndef _SIDECAR_H
+#define _SIDECAR_H
+
+#include "liblangid.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* Language index sidecar for a line file: for each line, the id of its
+ * language (1 byte) and its length in bytes (LEB128 varint), so offsets are
+ * a running sum. A trailer holds per-language line counts.
+ *
+ * layout (little-endian):
+ *   "LIDX" u32 version u32 num_langs u64 num_lines u64 trailer_offset
+ *   num_langs NUL-terminated language names
+ *   num_lines records: u8 lang, varint length
+ *   trailer: u64 count[num_langs + 1] (the last counts SIDECAR_NONE)
+ */
+
+#define SIDECAR_VERSION 1
+/* lang id for lines that weren't identified (e.g. -t/-J field absent) */
+#define SIDECAR_NONE 0xff
+
+typedef struct {
+  FILE* f;
+  unsigned num_langs;
+  uint64_t num_lines;
+  uint64_t* counts;
+} SidecarWriter;
+
+extern SidecarWriter* open_sidecar(char const* path, LanguageIdentifier*);
+extern void sidecar_add(SidecarWriter*, LangIndex, size_t linelen);
+extern void close_sidecar(SidecarWriter*);
+
+typedef struct {
+  unsigned char const* base;
+  size_t len;
+  unsigned num_langs;
+  uint64_t num_lines;
+  char const** names;
+  unsigned char const* recs; /* first record */
+  unsigned char const* end;  /* end of records = trailer */
+} SidecarReader;
+
+extern SidecarReader* load_sidecar(char const* path);
+extern void destroy_sidecar(SidecarReader*);
+/** number of lines identified as lang i (SIDECAR_NONE for unidentified) */
+extern uint64_t sidecar_count(SidecarReader*, unsigned i);
+/** lang id for name, or SIDECAR_NONE if unknown */
+extern unsigned sidecar_lang_index(SidecarReader*, char const* name);
+
+/** decode the record at p; returns the next record */
+static inline unsigned char const* sidecar_next(unsigned char const* p, unsigned* lang, uint64_t* linelen) {
+  unsigned shift = 0;
+  *lang = *p++;
+  *linelen = 0;
+  do
+    *linelen |= (uint64_t)(*p & 0x7f) << shift, shift += 7;
+  while (*p++ & 0x80);
+  return p;
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Throughput of the SQLite extension (langid_sqlite.c) over a large table:
+ *
+ *   sqlitebench [-x extension] [-d db] [-n rows] < corpus
+ *
+ * fills table docs(t TEXT) with n rows cycling through the lines of stdin,
+ * checks that langid(t) agrees with liblangid on every row, and times a
+ * plain scan, reading the rows out and identifying them in C (what an
+ * export would do at best), and langid(), langid_score() and langid_hist()
+ * in SQL.
+ */
+
+#include "liblangid.h"
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+char const *getoptspec = "hx:d:n:";
+
+void usage() {
+  printf("sqlitebench [-x extension] [-d db] [-n rows] < corpus (%s)\n"
+         "\n -x: the extension to load (default ./langid_sqlite)"
+         "\n -d: database file (default in memory; docs is replaced)"
+         "\n -n: rows (default 1000000)"
+         "\n\n",
+         getoptspec);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static sqlite3 *db;
+
+static void check(int rc, char const *what) {
+  if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_ROW) {
+    fprintf(stderr, "%s: %s\n", what, sqlite3_errmsg(db));
+    exit(-1);
+  }
+}
+
+static sqlite3_stmt *prepare(char const *sql) {
+  sqlite3_stmt *st;
+  check(sqlite3_prepare_v2(db, sql, -1, &st, NULL), sql);
+  return st;
+}
+
+static void exec(char const *sql) { check(sqlite3_exec(db, sql, 0, 0, 0), sql); }
+
+static void report(char const *what, double t, unsigned long rows,
+                   double bytes) {
+  printf("%-32s %7.3f s %9.0f rows/s %7.1f MB/s\n", what, t, rows / t,
+         bytes / t / 1e6);
+}
+
+/* step through sql, returning the first column of the last row as text in
+ * last (if given) */
+static double run(char const *sql, char *last, size_t size) {
+  sqlite3_stmt *st = prepare(sql);
+  double t = now();
+  int rc;
+  while ((rc = sqlite3_step(st)) == SQLITE_ROW)
+    if (last)
+      snprintf(last, size, "%s", (char const *)sqlite3_column_text(st, 0));
+  check(rc, sql);
+  t = now() - t;
+  sqlite3_finalize(st);
+  return t;
+}
+
+int main(int argc, char **argv) {
+  char *ext = "./langid_sqlite", *path = ":memory:", *line = NULL, **lines = NULL;
+  char *err = NULL, result[4096];
+  size_t line_size = 0, nlines = 0, cap = 0, i;
+  unsigned long rows = 1000000, r, differ = 0, sum = 0;
+  double bytes = 0, t;
+  ssize_t len;
+  LanguageIdentifier *lid;
+  sqlite3_stmt *st;
+  int c;
+
+  while ((c = getopt(argc, argv, getoptspec)) != -1)
+    switch (c) {
+    case 'x':
+      ext = optarg;
+      break;
+    case 'd':
+      path = optarg;
+      break;
+    case 'n':
+      rows = strtoul(optarg, NULL, 10);
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+
+  while ((len = getline(&line, &line_size, stdin)) > 0) {
+    if (line[len - 1] == '\n')
+      line[--len] = 0;
+    if (nlines == cap &&
+        (lines = realloc(lines, (cap = cap ? 2 * cap : 1024) * sizeof(char *))) == 0)
+      exit(-1);
+    lines[nlines++] = strdup(line);
+  }
+  if (!nlines) {
+    fprintf(stderr, "no corpus lines on stdin\n");
+    return 1;
+  }
+
+  check(sqlite3_open(path, &db), path);
+  sqlite3_enable_load_extension(db, 1);
+  if (sqlite3_load_extension(db, ext, NULL, &err) != SQLITE_OK) {
+    fprintf(stderr, "loading %s: %s\n", ext, err);
+    return 1;
+  }
+  exec("PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF;"
+       "DROP TABLE IF EXISTS docs; CREATE TABLE docs(t TEXT)");
+
+  t = now();
+  exec("BEGIN");
+  st = prepare("INSERT INTO docs VALUES (?)");
+  for (r = 0; r < rows; r++) {
+    char const *s = lines[r % nlines];
+    size_t n = strlen(s);
+    bytes += n;
+    sqlite3_bind_text(st, 1, s, n, SQLITE_STATIC);
+    check(sqlite3_step(st), "insert");
+    sqlite3_reset(st);
+  }
+  sqlite3_finalize(st);
+  exec("COMMIT");
+  report("insert", now() - t, rows, bytes);
+
+  /* agreement, row by row */
+  lid = get_default_identifier();
+  st = prepare("SELECT t, langid(t) FROM docs");
+  while (sqlite3_step(st) == SQLITE_ROW) {
+    char const *s = (char const *)sqlite3_column_text(st, 0);
+    LangIndex li = identify_index(lid, s, sqlite3_column_bytes(st, 0));
+    differ += strcmp(get_lang_name(lid, li), (char const *)sqlite3_column_text(st, 1)) != 0;
+  }
+  sqlite3_finalize(st);
+  printf("langid(t) differs from liblangid on %lu of %lu rows\n", differ, rows);
+
+  report("SELECT sum(length(t))", run("SELECT sum(length(t)) FROM docs", 0, 0),
+         rows, bytes);
+
+  st = prepare("SELECT t FROM docs");
+  t = now();
+  while (sqlite3_step(st) == SQLITE_ROW)
+    sum += identify_index(lid, (char const *)sqlite3_column_text(st, 0),
+                          sqlite3_column_bytes(st, 0));
+  report("SELECT t + identify in C", now() - t, rows, bytes);
+  sqlite3_finalize(st);
+
+  report("SELECT langid(t)", run("SELECT langid(t) FROM docs", 0, 0), rows,
+         bytes);
+  report("langid_score(t, 'en') > 0.5",
+         run("SELECT count(*) FROM docs WHERE langid_score(t, 'en') > 0.5",
+             result, sizeof(result)),
+         rows, bytes);
+  printf("  %s rows\n", result);
+  report("SELECT langid_hist(t)",
+         run("SELECT langid_hist(t) FROM docs", result, sizeof(result)), rows,
+         bytes);
+  printf("  %s\n", result);
+
+  sqlite3_close(db);
+  destroy_identifier(lid);
+  for (i = 0; i < nlines; i++)
+    free(lines[i]);
+  free(lines);
+  free(line);
+  return sum == (unsigned long)-1;
+}
@@ -0,0 +1,179 @@
+/*
+ * Encoding detection and streaming decoding to UTF-8; see transcode.h
+ */
+
+#include "transcode.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+/* UTF-16 detection looks at this much of a document */
+#define DETECT_SAMPLE 4096
+
+/* decoded bytes are fed in chunks of (at most) this */
+#define FEED_CHUNK 256
+
+static char const* const names[] = {"utf-8", "utf-16le", "utf-16be", "latin1", "cp1252", "auto"};
+
+/* windows-1252 0x80..0x9f; the five unassigned bytes map to C1 as in
+   Latin-1 */
+static unsigned short const cp1252_c1[32] = {
+    0x20ac, 0x0081, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021, 0x02c6, 0x2030, 0x0160,
+    0x2039, 0x0152, 0x008d, 0x017d, 0x008f, 0x0090, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022,
+    0x2013, 0x2014, 0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x009d, 0x017e, 0x0178};
+
+int encoding_by_name(char const* name) {
+  char buf[16];
+  unsigned n = 0;
+  int i;
+  for (; *name && n < sizeof(buf) - 1; ++name)
+    if (*name != '-' && *name != '_') buf[n++] = *name;
+  buf[n] = 0;
+  if (!strcasecmp(buf, "iso88591")) return ENC_LATIN1;
+  if (!strcasecmp(buf, "windows1252")) return ENC_CP1252;
+  for (i = 0; i <= ENC_AUTO; ++i) {
+    char const* s = names[i];
+    char want[16];
+    unsigned m = 0;
+    for (; *s; ++s)
+      if (*s != '-') want[m++] = *s;
+    want[m] = 0;
+    if (!strcasecmp(buf, want)) return i;
+  }
+  return -1;
+}
+
+char const* encoding_name(Encoding enc) { return names[enc]; }
+
+size_t encoding_bom(char const* text, size_t len, Encoding enc) {
+  unsigned char const* t = (unsigned char const*)text;
+  switch (enc) {
+    case ENC_UTF8: return len >= 3 && t[0] == 0xef && t[1] == 0xbb && t[2] == 0xbf ? 3 : 0;
+    case ENC_UTF16LE: return len >= 2 && t[0] == 0xff && t[1] == 0xfe ? 2 : 0;
+    case ENC_UTF16BE: return len >= 2 && t[0] == 0xfe && t[1] == 0xff ? 2 : 0;
+    default: return 0;
+  }
+}
+
+/* whether text is UTF-8 (shortest forms and surrogates aren't checked) */
+static int valid_utf8(unsigned char const* t, size_t len) {
+  unsigned char const* end = t + len;
+  uint64_t w;
+  while (t < end) {
+    if (end - t >= 8) {
+      memcpy(&w, t, 8);
+      if (!(w & 0x8080808080808080ull)) {
+        t += 8;
+        continue;
+      }
+    }
+    unsigned c = *t++, more;
+    if (c < 0x80) continue;
+    if (c < 0xc2 || c > 0xf4) return 0;
+    more = c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;
+    if (end - t < more) return 0;
+    for (; more; --more)
+      if ((*t++ & 0xc0) != 0x80) return 0;
+  }
+  return 1;
+}
+
+Encoding detect_encoding(char const* text, size_t len, size_t* bom) {
+  size_t i, n = (len < DETECT_SAMPLE ? len : DETECT_SAMPLE) & ~(size_t)1, zeros[2] = {0, 0};
+  Encoding enc;
+  for (enc = ENC_UTF8; enc <= ENC_UTF16BE; ++enc)
+    if ((*bom = encoding_bom(text, len, enc))) return enc;
+  for (i = 0; i < n; ++i) zeros[i & 1] += !text[i];
+  /* mostly-ASCII UTF-16 has a NUL in (nearly) every other byte */
+  if (zeros[0] + zeros[1] >= n / 8) {
+    if (zeros[1] > 4 * zeros[0]) return ENC_UTF16LE;
+    if (zeros[0] > 4 * zeros[1]) return ENC_UTF16BE;
+  }
+  return valid_utf8((unsigned char const*)text, len) ? ENC_UTF8 : ENC_CP1252;
+}
+
+static void feed_utf8(LanguageIdentifier* lid, char const* text, size_t len) {
+  /* identify_feed lengths are unsigned */
+  for (; len > 1u << 30; text += 1u << 30, len -= 1u << 30) identify_feed(lid, text, 1u << 30);
+  identify_feed(lid, text, len);
+}
+
+/* ASCII runs are fed straight from text; only the high bytes go through
+   buf */
+static void feed_single_byte(LanguageIdentifier* lid, char const* text, size_t len, Encoding enc) {
+  char buf[FEED_CHUNK];
+  unsigned n = 0, c;
+  char const *p = text, *end = text + len, *run = text;
+  while (p < end) {
+    if (!(*p & 0x80)) {
+      ++p;
+      continue;
+    }
+    if (p > run) {
+      if (n) identify_feed(lid, buf, n), n = 0;
+      feed_utf8(lid, run, p - run);
+    }
+    for (; p < end && (*p & 0x80); ++p) {
+      c = (unsigned char)*p;
+      if (enc == ENC_CP1252 && c < 0xa0) c = cp1252_c1[c - 0x80];
+      n += put_utf8(buf + n, c);
+      if (n > sizeof(buf) - 4) identify_feed(lid, buf, n), n = 0;
+    }
+    run = p;
+  }
+  if (n) identify_feed(lid, buf, n);
+  if (end > run) feed_utf8(lid, run, end - run);
+}
+
+static void feed_utf16(LanguageIdentifier* lid, char const* text, size_t len, int be) {
+  char buf[FEED_CHUNK];
+  unsigned char const* t = (unsigned char const*)text;
+  unsigned char const* end = t + (len & ~(size_t)1);
+  unsigned n = 0, u, lo;
+  while (t < end) {
+    u = be ? t[0] << 8 | t[1] : t[1] << 8 | t[0];
+    t += 2;
+    if (u >= 0xd800 && u < 0xe000) {
+      lo = t < end ? (be ? t[0] << 8 | t[1] : t[1] << 8 | t[0]) : 0;
+      if (u < 0xdc00 && lo >= 0xdc00 && lo < 0xe000) {
+        u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+        t += 2;
+      } else
+        u = 0xfffd;
+    }
+    n += put_utf8(buf + n, u);
+    if (n > sizeof(buf) - 4) identify_feed(lid, buf, n), n = 0;
+  }
+  if (n) identify_feed(lid, buf, n);
+}
+
+void identify_feed_encoded(LanguageIdentifier* lid, char const* text, size_t len, Encoding enc) {
+  switch (enc) {
+    case ENC_UTF16LE: feed_utf16(lid, text, len, 0); break;
+    case ENC_UTF16BE: feed_utf16(lid, text, len, 1); break;
+    case ENC_LATIN1:
+    case ENC_CP1252: feed_single_byte(lid, text, len, enc); break;
+    default: feed_utf8(lid, text, len);
+  }
+}
+
+unsigned put_utf8(char* o, unsigned u) {
+  if (u < 0x80) {
+    o[0] = u;
+    return 1;
+  } else if (u < 0x800) {
+    o[0] = 0xc0 | u >> 6;
+    o[1] = 0x80 | (u & 0x3f);
+    return 2;
+  } else if (u < 0x10000) {
+    o[0] = 0xe0 | u >> 12;
+    o[1] = 0x80 | (u >> 6 & 0x3f);
+    o[2] = 0x80 | (u & 0x3f);
+    return 3;
+  }
+  o[0] = 0xf0 | u >> 18;
+  o[1] = 0x80 | (u >> 12 & 0x3f);
+  o[2] = 0x80 | (u >> 6 & 0x3f);
+  o[3] = 0x80 | (u & 0x3f);
+  return 4;
+}
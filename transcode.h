@@ -0,0 +1,43 @@
+#ifndef _TRANSCODE_H
+#define _TRANSCODE_H
+
+#include "liblangid.h"
+#include <stddef.h>
+
+/* The model works on UTF-8 bytes. Documents in other encodings are decoded
+ * on the fly into small stack chunks that go straight to identify_feed, so
+ * no UTF-8 copy of the document is made.
+ */
+
+typedef enum {
+  ENC_UTF8,
+  ENC_UTF16LE,
+  ENC_UTF16BE,
+  ENC_LATIN1,
+  ENC_CP1252,
+  ENC_AUTO, /* detect_encoding per document */
+  NUM_ENCODINGS = ENC_AUTO
+} Encoding;
+
+/** "auto", "utf-8", "utf-16le", "utf-16be", "latin1" or "cp1252"
+    (case-insensitive, - and _ optional); -1 if unknown */
+extern int encoding_by_name(char const*);
+extern char const* encoding_name(Encoding);
+
+/** length of enc's byte order mark at the start of text, or 0 */
+extern size_t encoding_bom(char const* text, size_t len, Encoding enc);
+
+/** the encoding of text from its BOM if any, else by heuristics: NUL bytes
+    concentrated on one parity mean BOM-less UTF-16, and text that isn't
+    valid UTF-8 is taken as CP1252 (which, as in browsers, also covers
+    Latin-1). *bom is set to the BOM length. */
+extern Encoding detect_encoding(char const* text, size_t len, size_t* bom);
+
+/** identify_feed text[0..len) decoded from enc to UTF-8. Malformed UTF-16
+    becomes U+FFFD; a trailing odd byte is ignored. */
+extern void identify_feed_encoded(LanguageIdentifier*, char const* text, size_t len, Encoding enc);
+
+/** write u as UTF-8 to o (at most 4 bytes); returns the length */
+extern unsigned put_utf8(char* o, unsigned u);
+
+#endif
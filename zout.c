@@ -0,0 +1,217 @@
+/*
+ * Block-parallel compressed output; see zout.h
+ *
+ * The stream is a ring of 2 * threads + 1 blocks. The writing thread fills
+ * blocks in turn and queues each full one for the workers; before reusing
+ * a slot it waits for that block to be compressed and writes it out, so
+ * blocks reach the file in order while the next ones are compressed.
+ */
+
+#define _GNU_SOURCE /* fopencookie */
+#include "zout.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+enum { ZOUT_GZIP, ZOUT_ZSTD };
+enum { BLOCK_FREE, BLOCK_QUEUED, BLOCK_DONE };
+
+typedef struct {
+  char *in, *out;
+  size_t in_len, out_len, out_cap;
+  int state;
+} Block;
+
+typedef struct {
+  FILE* f;
+  int format;
+  unsigned threads, nblocks;
+  Block* blocks;
+  pthread_t* workers;
+  pthread_mutex_t lock;
+  pthread_cond_t queued, done;
+  unsigned long submitted, taken; /* blocks; block i is in slot i % nblocks */
+  int quit;
+} ZOut;
+
+static int has_suffix(char const* s, char const* suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && !strcmp(s + n - m, suffix);
+}
+
+int compressed_path(char const* path) {
+  return has_suffix(path, ".gz") || has_suffix(path, ".zst");
+}
+
+static size_t bound(ZOut* z, size_t len) {
+#ifdef HAVE_ZSTD
+  if (z->format == ZOUT_ZSTD) return ZSTD_compressBound(len);
+#endif
+  return compressBound(len) + 32; /* plus the gzip header and trailer */
+}
+
+static void compress_block(ZOut* z, Block* b) {
+  z_stream zs;
+  size_t cap = bound(z, b->in_len);
+  if (cap > b->out_cap) {
+    free(b->out);
+    if ((b->out = (char*)malloc(cap)) == 0) exit(-1);
+    b->out_cap = cap;
+  }
+#ifdef HAVE_ZSTD
+  if (z->format == ZOUT_ZSTD) {
+    b->out_len = ZSTD_compress(b->out, cap, b->in, b->in_len, 3);
+    if (ZSTD_isError(b->out_len)) {
+      fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(b->out_len));
+      exit(-1);
+    }
+    return;
+  }
+#endif
+  memset(&zs, 0, sizeof zs);
+  /* 16 + 15: a gzip member with a 32K window */
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) exit(-1);
+  zs.next_in = (Bytef*)b->in;
+  zs.avail_in = b->in_len;
+  zs.next_out = (Bytef*)b->out;
+  zs.avail_out = cap;
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+    fprintf(stderr, "gzip: compression failed\n");
+    exit(-1);
+  }
+  b->out_len = zs.total_out;
+  deflateEnd(&zs);
+}
+
+static void* compress_blocks(void* arg) {
+  ZOut* z = (ZOut*)arg;
+  Block* b;
+  pthread_mutex_lock(&z->lock);
+  for (;;) {
+    while (z->taken == z->submitted && !z->quit) pthread_cond_wait(&z->queued, &z->lock);
+    if (z->taken == z->submitted) break;
+    b = &z->blocks[z->taken++ % z->nblocks];
+    pthread_mutex_unlock(&z->lock);
+    compress_block(z, b);
+    pthread_mutex_lock(&z->lock);
+    b->state = BLOCK_DONE;
+    pthread_cond_broadcast(&z->done);
+  }
+  pthread_mutex_unlock(&z->lock);
+  return NULL;
+}
+
+/* wait for b to be compressed, and write it out */
+static void retire(ZOut* z, Block* b) {
+  pthread_mutex_lock(&z->lock);
+  while (b->state == BLOCK_QUEUED) pthread_cond_wait(&z->done, &z->lock);
+  pthread_mutex_unlock(&z->lock);
+  if (b->state == BLOCK_DONE && fwrite(b->out, 1, b->out_len, z->f) != b->out_len) {
+    fprintf(stderr, "error writing compressed output\n");
+    exit(-1);
+  }
+  b->state = BLOCK_FREE;
+  b->in_len = 0;
+}
+
+static Block* current(ZOut* z) {
+  return &z->blocks[z->submitted % z->nblocks];
+}
+
+static void submit(ZOut* z) {
+  Block* b = current(z);
+  pthread_mutex_lock(&z->lock);
+  b->state = BLOCK_QUEUED;
+  z->submitted++;
+  pthread_cond_signal(&z->queued);
+  pthread_mutex_unlock(&z->lock);
+  /* the next slot holds the oldest block */
+  retire(z, current(z));
+}
+
+static ssize_t zout_write(void* cookie, char const* buf, size_t size) {
+  ZOut* z = (ZOut*)cookie;
+  size_t left = size, n;
+  Block* b;
+  while (left) {
+    b = current(z);
+    n = ZOUT_BLOCK - b->in_len < left ? ZOUT_BLOCK - b->in_len : left;
+    memcpy(b->in + b->in_len, buf, n);
+    b->in_len += n;
+    buf += n;
+    left -= n;
+    if (b->in_len == ZOUT_BLOCK) submit(z);
+  }
+  return size;
+}
+
+static int zout_close(void* cookie) {
+  ZOut* z = (ZOut*)cookie;
+  unsigned i;
+  int r;
+  /* an empty output is still one (empty) member */
+  if (current(z)->in_len || !z->submitted) submit(z);
+  pthread_mutex_lock(&z->lock);
+  z->quit = 1;
+  pthread_cond_broadcast(&z->queued);
+  pthread_mutex_unlock(&z->lock);
+  /* the rest, oldest first; the current slot is free */
+  for (i = 1; i < z->nblocks; i++) retire(z, &z->blocks[(z->submitted + i) % z->nblocks]);
+  for (i = 0; i < z->threads; i++) pthread_join(z->workers[i], NULL);
+  for (i = 0; i < z->nblocks; i++) {
+    free(z->blocks[i].in);
+    free(z->blocks[i].out);
+  }
+  r = fclose(z->f);
+  pthread_mutex_destroy(&z->lock);
+  pthread_cond_destroy(&z->queued);
+  pthread_cond_destroy(&z->done);
+  free(z->blocks);
+  free(z->workers);
+  free(z);
+  return r;
+}
+
+FILE* open_output(char const* path, unsigned threads) {
+  cookie_io_functions_t io = {NULL, zout_write, NULL, zout_close};
+  ZOut* z;
+  FILE* f;
+  unsigned i;
+  int format;
+
+  if (has_suffix(path, ".gz"))
+    format = ZOUT_GZIP;
+  else if (has_suffix(path, ".zst")) {
+#ifndef HAVE_ZSTD
+    fprintf(stderr, "ERROR: built without zstd (make ZSTD=1) for '%s'\n", path);
+    exit(-1);
+#endif
+    format = ZOUT_ZSTD;
+  } else
+    return fopen(path, "w");
+
+  if ((f = fopen(path, "w")) == NULL) return NULL;
+  if (!threads) threads = 1;
+  if ((z = (ZOut*)calloc(1, sizeof(ZOut))) == 0) exit(-1);
+  z->f = f;
+  z->format = format;
+  z->threads = threads;
+  z->nblocks = 2 * threads + 1;
+  if ((z->blocks = (Block*)calloc(z->nblocks, sizeof(Block))) == 0) exit(-1);
+  for (i = 0; i < z->nblocks; i++)
+    if ((z->blocks[i].in = (char*)malloc(ZOUT_BLOCK)) == 0) exit(-1);
+  pthread_mutex_init(&z->lock, NULL);
+  pthread_cond_init(&z->queued, NULL);
+  pthread_cond_init(&z->done, NULL);
+  if ((z->workers = (pthread_t*)malloc(threads * sizeof(pthread_t))) == 0) exit(-1);
+  for (i = 0; i < threads; i++)
+    if (pthread_create(&z->workers[i], NULL, compress_blocks, z)) {
+      fprintf(stderr, "unable to start compression thread %u\n", i);
+      exit(-1);
+    }
+  return fopencookie(z, "w", io);
+}
@@ -0,0 +1,23 @@
+#ifndef _ZOUT_H
+#define _ZOUT_H
+
+#include <stdio.h>
+
+/* Compressed output: open_output gives a FILE* like fopen(path, "w"), but
+ * if path ends in .gz (or .zst, when built with ZSTD=1) what is written is
+ * cut into ZOUT_BLOCK blocks, compressed on worker threads and written in
+ * order, each block as its own gzip member (zstd frame). Concatenated
+ * members are a standard file that gzip -d / zstd -d read whole. fclose
+ * finishes the stream; the file isn't seekable.
+ */
+
+#ifndef ZOUT_BLOCK
+#define ZOUT_BLOCK (1u << 20)
+#endif
+
+/** NULL if path can't be opened. threads 0: one */
+extern FILE* open_output(char const* path, unsigned threads);
+/** whether path names a compressed output */
+extern int compressed_path(char const* path);
+
+#endif